@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include "spdlog/spdlog.h"
+#include "admission_control.h"
+#include "transform_stream_api.h"
+
+namespace
+{
+    int64_t NowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //utime + stime of the whole process, in clock ticks
+    int64_t ProcessCpuTicks(int pid)
+    {
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string content;
+        std::getline(stat, content);
+        //comm may contain spaces, fields are counted after the closing ')'
+        size_t pos = content.rfind(')');
+        if (pos == std::string::npos)
+        {
+            return 0;
+        }
+        std::istringstream fields(content.substr(pos + 2));
+        std::string field;
+        int64_t utime = 0, stime = 0;
+        for (int i = 3; i <= 15 && fields >> field; i++)
+        {
+            if (i == 14)
+                utime = std::stoll(field);
+            else if (i == 15)
+                stime = std::stoll(field);
+        }
+        return utime + stime;
+    }
+
+    int64_t ProcessRssBytes(int pid)
+    {
+        std::ifstream statm("/proc/" + std::to_string(pid) + "/statm");
+        int64_t size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+} // namespace
+
+AdmissionControl::AdmissionControl(const AdmissionBudget &budget, const std::shared_ptr<TransformStreamApi> &transform_api)
+    : budget_(budget), transform_api_(transform_api)
+{
+    last_sample_us_ = NowUs();
+    Sample();
+    sampler_ = std::thread(&AdmissionControl::SampleLoop, this);
+}
+
+AdmissionControl::~AdmissionControl()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    sampler_.join();
+}
+
+bool AdmissionControl::Admit(const std::string &input_url, const std::vector<TransformSessionInfo> &infos, bool complete, std::string &reason)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    AdmissionUsage usage = Count(infos, complete);
+    if (!usage.accepting)
+    {
+        reason = usage.reason;
+        spdlog::warn("AdmissionControl reject new transform: {}", reason);
+        return false;
+    }
+    pending_.insert(input_url);
+    return true;
+}
+
+void AdmissionControl::Release(const std::string &input_url)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto iter = pending_.find(input_url);
+    if (iter != pending_.end())
+    {
+        pending_.erase(iter);
+    }
+}
+
+AdmissionUsage AdmissionControl::Usage()
+{
+    std::vector<TransformSessionInfo> infos;
+    bool complete = transform_api_->sessions(infos);
+    std::lock_guard<std::mutex> lock(mtx_);
+    return Count(infos, complete);
+}
+
+//called with mtx_ held
+AdmissionUsage AdmissionControl::Count(const std::vector<TransformSessionInfo> &infos, bool complete)
+{
+    int64_t input_bitrate = 0, memory = 0;
+    std::set<std::string> running;
+    for (auto &info : infos)
+    {
+        input_bitrate += info.input_bitrate;
+        memory += info.memory_packet + info.memory_avio + info.memory_cache + info.memory_ring;
+        running.insert(info.input_url);
+    }
+
+    //a pending start is charged what an average running session uses, until it shows up in infos
+    AdmissionUsage usage;
+    std::set<std::string> pending;
+    for (const std::string &input_url : pending_)
+    {
+        if (!running.count(input_url))
+            pending.insert(input_url);
+    }
+    usage.pending = pending.size();
+    size_t sessions = infos.size() + pending.size();
+    if (!infos.empty())
+    {
+        input_bitrate += input_bitrate / int64_t(infos.size()) * int64_t(pending.size());
+        memory += memory / int64_t(infos.size()) * int64_t(pending.size());
+    }
+
+    Check(usage.sessions, sessions, budget_.max_sessions, "sessions", usage);
+    Check(usage.cpu, cpu_percent_, budget_.max_cpu, "cpu", usage);
+    Check(usage.input_kbps, input_bitrate / 1000, budget_.max_input_kbps, "input_kbps", usage);
+    Check(usage.rss_mb, rss_bytes_ >> 20, budget_.max_rss_mb, "rss_mb", usage);
+    Check(usage.memory_mb, memory >> 20, budget_.max_memory_mb, "memory_mb", usage);
+    //the missing sessions may be what fills a budget, nothing is admitted on a partial count
+    bool counted = budget_.max_sessions > 0 || budget_.max_input_kbps > 0 || budget_.max_memory_mb > 0;
+    if (!complete && counted && usage.accepting)
+    {
+        usage.accepting = false;
+        usage.reason = "session count unknown, a worker did not answer";
+    }
+    return usage;
+}
+
+int AdmissionControl::RetryAfter() const
+{
+    return budget_.retry_after;
+}
+
+void AdmissionControl::SampleLoop()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    //cpu usage needs a window, sampling more often than this only adds noise
+    while (!cv_.wait_for(lock, std::chrono::seconds(1), [this] { return quit_; }))
+    {
+        Sample();
+    }
+}
+
+void AdmissionControl::Sample()
+{
+    //in multi-process mode the media work happens in the workers, they are summed with this process;
+    //a worker seen for the first time only starts its cpu window
+    std::vector<int> pids(1, getpid());
+    transform_api_->worker_pids(pids);
+    int64_t now = NowUs();
+    int64_t ticks = 0, rss = 0;
+    std::map<int, int64_t> cpu_ticks;
+    for (int pid : pids)
+    {
+        int64_t pid_ticks = ProcessCpuTicks(pid);
+        auto iter = last_cpu_ticks_.find(pid);
+        if (iter != last_cpu_ticks_.end())
+            ticks += pid_ticks - iter->second;
+        cpu_ticks[pid] = pid_ticks;
+        rss += ProcessRssBytes(pid);
+    }
+
+    static const long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    static const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    double wall_sec = double(now - last_sample_us_) / 1000000;
+    if (wall_sec > 0)
+    {
+        cpu_percent_ = double(ticks) / ticks_per_sec / wall_sec / cores * 100;
+    }
+
+    last_cpu_ticks_.swap(cpu_ticks);
+    last_sample_us_ = now;
+    rss_bytes_ = rss;
+}
+
+void AdmissionControl::Check(AdmissionResource &res, double used, double budget, const char *name, AdmissionUsage &usage)
+{
+    res.used = used;
+    res.budget = budget;
+    res.headroom = budget > 0 ? budget - used : -1;
+    if (budget > 0 && used >= budget && usage.accepting)
+    {
+        usage.accepting = false;
+        usage.reason = std::string(name) + " over budget: " + std::to_string(used) + "/" + std::to_string(budget);
+    }
+}
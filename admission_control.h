@@ -0,0 +1,76 @@
+#pragma once
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <cstdint>
+
+class TransformStreamApi;
+struct TransformSessionInfo;
+
+//0 means unlimited for every budget
+struct AdmissionBudget
+{
+    int max_sessions = 0;
+    double max_cpu = 0;         //percent of the whole machine
+    int64_t max_input_kbps = 0; //sum of all session input bitrates
+    int64_t max_rss_mb = 0;
+    int64_t max_memory_mb = 0;  //sum of the sessions' accounted buffers, see MemoryBudget
+    int retry_after = 5;        //seconds, sent back with 503
+};
+
+struct AdmissionResource
+{
+    double used = 0;
+    double budget = 0;
+    double headroom = 0; //budget - used, -1 if unlimited
+};
+
+struct AdmissionUsage
+{
+    AdmissionResource sessions;
+    AdmissionResource cpu;
+    AdmissionResource input_kbps;
+    AdmissionResource rss_mb;
+    AdmissionResource memory_mb;
+    int pending = 0; //admitted starts not running yet, counted in the resources above
+    bool accepting = true;
+    std::string reason;
+};
+
+class AdmissionControl
+{
+public:
+    AdmissionControl(const AdmissionBudget &budget, const std::shared_ptr<TransformStreamApi> &transform_api);
+    ~AdmissionControl();
+    //infos and complete are what the caller's transform_api->sessions() returned, so a start asks only once;
+    //an admitted input_url holds its share of the budgets until Release, concurrent starts can not overbook
+    bool Admit(const std::string &input_url, const std::vector<TransformSessionInfo> &infos, bool complete, std::string &reason);
+    //the admitted start read its first frame or failed
+    void Release(const std::string &input_url);
+    AdmissionUsage Usage();
+    int RetryAfter() const;
+
+private:
+    AdmissionUsage Count(const std::vector<TransformSessionInfo> &infos, bool complete);
+    //cpu and rss are sampled every second, a request after an idle period must not see stale values
+    void SampleLoop();
+    void Sample();
+    static void Check(AdmissionResource &res, double used, double budget, const char *name, AdmissionUsage &usage);
+
+    AdmissionBudget budget_;
+    std::shared_ptr<TransformStreamApi> transform_api_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool quit_ = false;
+    int64_t last_sample_us_ = 0;
+    std::map<int, int64_t> last_cpu_ticks_; //by pid, this process and its workers
+    std::multiset<std::string> pending_; //admitted input urls, one per Admit
+    double cpu_percent_ = 0;
+    int64_t rss_bytes_ = 0;
+    std::thread sampler_;
+};
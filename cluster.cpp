@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cpprest/http_client.h>
+#include "spdlog/spdlog.h"
+#include "cluster.h"
+
+using namespace web;
+using namespace http;
+using namespace http::client;
+
+const char *Cluster::kForwardHeader = "X-Cluster-Forwarded";
+
+Cluster::Cluster(const std::string &self, const std::vector<std::string> &nodes, const std::string &mode, int replicas, int check_interval, int fail_threshold)
+    : self_(self), redirect_(mode == "redirect"), check_interval_(check_interval), fail_threshold_(fail_threshold), ring_(replicas)
+{
+    //every node is assumed alive until its first failed checks, so routing works before the first poll
+    ring_.AddNode(self_);
+    for (const std::string &node : nodes)
+    {
+        ring_.AddNode(node);
+        if (node != self_)
+        {
+            nodes_[node] = NodeState();
+        }
+    }
+}
+
+Cluster::~Cluster()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        quit_ = true;
+    }
+    cv_.notify_one();
+    if (check_thr_.joinable())
+    {
+        check_thr_.join();
+    }
+}
+
+void Cluster::Run(const SessionsFunc &local_sessions, const SessionFunc &restore, const SessionFunc &release)
+{
+    local_sessions_ = local_sessions;
+    restore_ = restore;
+    release_ = release;
+    check_thr_ = std::thread(&Cluster::CheckLoop, this);
+    spdlog::info("Cluster {} started with {} nodes, mode {}", self_, ring_.Nodes().size(), redirect_ ? "redirect" : "forward");
+}
+
+std::string Cluster::Owner(const std::string &input_url)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return ring_.Owner(input_url);
+}
+
+bool Cluster::IsSelf(const std::string &node) const
+{
+    return node == self_;
+}
+
+const std::string &Cluster::Self() const
+{
+    return self_;
+}
+
+bool Cluster::Redirect() const
+{
+    return redirect_;
+}
+
+void Cluster::Nodes(std::vector<std::pair<std::string, bool>> &nodes)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    nodes.push_back(std::make_pair(self_, true));
+    for (auto &item : nodes_)
+    {
+        nodes.push_back(std::make_pair(item.first, item.second.alive));
+    }
+}
+
+void Cluster::CheckLoop()
+{
+    while (true)
+    {
+        std::vector<std::string> peers;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait_for(lock, std::chrono::seconds(check_interval_), [this] { return quit_; });
+            if (quit_)
+            {
+                return;
+            }
+            for (auto &item : nodes_)
+            {
+                peers.push_back(item.first);
+            }
+        }
+
+        for (const std::string &node : peers)
+        {
+            std::vector<ClusterSession> sessions;
+            bool complete = true;
+            bool ok = FetchSessions(node, sessions, complete);
+
+            bool went_down = false, came_up = false;
+            std::vector<ClusterSession> orphans;
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                NodeState &state = nodes_[node];
+                if (ok)
+                {
+                    state.failures = 0;
+                    //a source missing from a partial list keeps its last known state
+                    if (!complete)
+                    {
+                        for (auto &known : state.sessions)
+                        {
+                            if (std::none_of(sessions.begin(), sessions.end(), [&](const ClusterSession &s) { return s.input_url == known.input_url; }))
+                                sessions.push_back(known);
+                        }
+                    }
+                    state.sessions.swap(sessions);
+                    if (!state.alive)
+                    {
+                        state.alive = true;
+                        ring_.AddNode(node);
+                        came_up = true;
+                    }
+                }
+                else if (state.alive && ++state.failures >= fail_threshold_)
+                {
+                    state.alive = false;
+                    ring_.RemoveNode(node);
+                    orphans.swap(state.sessions);
+                    went_down = true;
+                }
+            }
+
+            if (went_down)
+            {
+                spdlog::warn("Cluster node {} left, {} sources to rebalance", node, orphans.size());
+                TakeOver(node, orphans);
+            }
+            else if (came_up)
+            {
+                spdlog::info("Cluster node {} joined", node);
+                GiveBack(node);
+            }
+        }
+    }
+}
+
+bool Cluster::FetchSessions(const std::string &node, std::vector<ClusterSession> &sessions, bool &complete)
+{
+    try
+    {
+        http_client_config config;
+        config.set_timeout(std::chrono::seconds(check_interval_));
+        http_client client(node, config);
+        http_request request(methods::GET);
+        request.set_request_uri(uri("/rest/api/v1/sessions"));
+        request.headers().add(kForwardHeader, self_);
+        http_response response = client.request(request).get();
+        if (response.status_code() != status_codes::OK)
+        {
+            return false;
+        }
+
+        json::value body = response.extract_json(true).get();
+        complete = !(body.has_field("incomplete") && body.at("incomplete").as_bool());
+        for (const json::value &item : body.at("data").as_array())
+        {
+            ClusterSession session;
+            session.input_url = item.at("url").as_string();
+            session.output_url = item.at("output_url").as_string();
+            session.auto_replay = item.at("auto_replay").as_bool();
+            session.options.shm_name = item.at("shm").as_string();
+            session.options.dvr_minutes = item.at("dvr").as_integer();
+            if (item.has_field("backup_urls"))
+            {
+                for (const json::value &backup : item.at("backup_urls").as_array())
+                {
+                    session.options.backup_urls.push_back(backup.as_string());
+                }
+            }
+            session.options.standby = item.has_field("standby") && item.at("standby").as_bool();
+            session.options.thin = item.at("thin").as_integer();
+            session.options.video_only = item.has_field("video_only") && item.at("video_only").as_bool();
+            sessions.push_back(session);
+        }
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        spdlog::trace("Cluster check {} failed: {}", node, e.what());
+        return false;
+    }
+}
+
+bool Cluster::HandOver(const std::string &node, const ClusterSession &session)
+{
+    try
+    {
+        http_client client(node);
+        uri_builder builder("/rest/api/v1/transform_stream");
+        //the server parses query values as they are, so they are not encoded here either
+        builder.append_query("url", session.input_url, false);
+        builder.append_query("output_url", session.output_url, false);
+        if (session.auto_replay)
+        {
+            builder.append_query("auto-replay", "true", false);
+        }
+        const TransformOptions &options = session.options;
+        if (!options.shm_name.empty())
+        {
+            builder.append_query("shm", options.shm_name, false);
+        }
+        if (options.dvr_minutes > 0)
+        {
+            builder.append_query("dvr", std::to_string(options.dvr_minutes), false);
+        }
+        if (!options.backup_urls.empty())
+        {
+            std::string backup_urls;
+            for (const std::string &backup_url : options.backup_urls)
+            {
+                backup_urls += (backup_urls.empty() ? "" : "|") + backup_url;
+            }
+            builder.append_query("backup_url", backup_urls, false);
+        }
+        if (options.standby)
+        {
+            builder.append_query("standby", "true", false);
+        }
+        if (options.thin > 0)
+        {
+            builder.append_query("thin", std::to_string(options.thin), false);
+        }
+        if (options.video_only)
+        {
+            builder.append_query("video_only", "true", false);
+        }
+        http_request request(methods::GET);
+        request.set_request_uri(builder.to_uri());
+        request.headers().add(kForwardHeader, self_);
+        http_response response = client.request(request).get();
+        return response.status_code() == status_codes::OK;
+    }
+    catch (const std::exception &e)
+    {
+        spdlog::error("Cluster hand over {} to {} failed: {}", session.input_url, node, e.what());
+        return false;
+    }
+}
+
+void Cluster::TakeOver(const std::string &node, const std::vector<ClusterSession> &sessions)
+{
+    //every survivor sees the same ring, so each orphan is restored by exactly one node
+    for (const ClusterSession &session : sessions)
+    {
+        if (IsSelf(Owner(session.input_url)))
+        {
+            spdlog::info("Cluster take over {} from {}", session.input_url, node);
+            restore_(session);
+        }
+    }
+}
+
+void Cluster::GiveBack(const std::string &node)
+{
+    //only the sources that hash to the returning node move, everything else stays where it is
+    std::vector<ClusterSession> sessions;
+    local_sessions_(sessions);
+    for (const ClusterSession &session : sessions)
+    {
+        if (Owner(session.input_url) != node)
+        {
+            continue;
+        }
+        spdlog::info("Cluster give back {} to {}", session.input_url, node);
+        //the output url is reused, stop publishing before the owner starts
+        release_(session);
+        if (!HandOver(node, session))
+        {
+            restore_(session);
+        }
+    }
+}
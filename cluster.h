@@ -0,0 +1,68 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <functional>
+#include <condition_variable>
+#include "hash_ring.h"
+#include "transform_stream_api.h"
+
+struct ClusterSession
+{
+    std::string input_url;
+    std::string output_url;
+    bool auto_replay = false;
+    TransformOptions options; //the node it moves to starts it the same way
+};
+
+//nodes listed in config.xml share a consistent hash ring over input_url. Every node polls its peers,
+//a peer missing fail_threshold checks leaves the ring and the survivors restore the sources that now
+//hash to them; a peer coming back gets its sources handed back
+class Cluster
+{
+public:
+    typedef std::function<void(std::vector<ClusterSession> &)> SessionsFunc;
+    typedef std::function<void(const ClusterSession &)> SessionFunc;
+    static const char *kForwardHeader;
+
+    Cluster(const std::string &self, const std::vector<std::string> &nodes, const std::string &mode, int replicas, int check_interval, int fail_threshold);
+    ~Cluster();
+    void Run(const SessionsFunc &local_sessions, const SessionFunc &restore, const SessionFunc &release);
+    std::string Owner(const std::string &input_url);
+    bool IsSelf(const std::string &node) const;
+    const std::string &Self() const;
+    bool Redirect() const;
+    void Nodes(std::vector<std::pair<std::string, bool>> &nodes);
+
+private:
+    struct NodeState
+    {
+        bool alive = true;
+        int failures = 0;
+        std::vector<ClusterSession> sessions;
+    };
+
+    void CheckLoop();
+    //complete is false when the peer could not list all its sessions, the missing ones are still running
+    bool FetchSessions(const std::string &node, std::vector<ClusterSession> &sessions, bool &complete);
+    bool HandOver(const std::string &node, const ClusterSession &session);
+    void TakeOver(const std::string &node, const std::vector<ClusterSession> &sessions);
+    void GiveBack(const std::string &node);
+
+    std::string self_;
+    bool redirect_;
+    int check_interval_;
+    int fail_threshold_;
+    SessionsFunc local_sessions_;
+    SessionFunc restore_, release_;
+
+    std::mutex mtx_;
+    HashRing ring_;
+    std::map<std::string, NodeState> nodes_;
+
+    std::thread check_thr_;
+    std::condition_variable cv_;
+    bool quit_ = false;
+};
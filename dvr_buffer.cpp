@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <spdlog/spdlog.h>
+
+extern "C"
+{
+#include <libavutil/time.h>
+#include <libavformat/avformat.h>
+}
+#include "dvr_buffer.h"
+
+DvrBuffer::~DvrBuffer()
+{
+	Close();
+	if (!writer_.Path().empty())
+	{
+		unlink(writer_.Path().c_str());
+	}
+}
+
+bool DvrBuffer::Create(const std::string &path, uint64_t capacity, int64_t window_us, std::string &err)
+{
+	window_us_ = window_us;
+	return writer_.Create(path, capacity, err);
+}
+
+void DvrBuffer::Sweep(const std::string &dir)
+{
+	DIR *dp = opendir(dir.c_str());
+	if (!dp)
+	{
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dp)) != NULL)
+	{
+		unsigned long long hash;
+		int pid, len = 0;
+		unsigned seq;
+		//a name that does not match exactly is not ours and stays
+		if (sscanf(entry->d_name, "%16llx-%d-%u.dvr%n", &hash, &pid, &seq, &len) != 3 || len == 0 || entry->d_name[len] != '\0')
+		{
+			continue;
+		}
+		if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH)
+		{
+			std::string path = dir + "/" + entry->d_name;
+			spdlog::info("DvrBuffer remove {} left by exited process {}", path, pid);
+			unlink(path.c_str());
+		}
+	}
+	closedir(dp);
+}
+
+void DvrBuffer::SetParams(const ShmStreamParams *streams, int nb_streams)
+{
+	writer_.SetParams(streams, nb_streams);
+}
+
+void DvrBuffer::Write(const ShmPacketHeader &pkt, const uint8_t *data, bool key)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	uint64_t pos = writer_.WritePos();
+	if (!writer_.Write(pkt, data))
+	{
+		return;
+	}
+
+	//half a second between index points is plenty for seeking and keeps audio-only sources small
+	int64_t now = av_gettime_relative();
+	if (key && (key_index_.empty() || now - key_index_.back().wall_us >= 500000))
+	{
+		key_index_.push_back(KeyEntry{now, pos});
+	}
+	Prune(now);
+}
+
+void DvrBuffer::Close()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	writer_.Close();
+	key_index_.clear();
+}
+
+bool DvrBuffer::Locate(int64_t offset_us, uint64_t &pos, int64_t &actual_offset_us)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	int64_t now = av_gettime_relative();
+	Prune(now);
+	if (key_index_.empty())
+	{
+		return false;
+	}
+
+	auto iter = key_index_.rbegin();
+	while (iter != key_index_.rend() && now - iter->wall_us < offset_us)
+	{
+		++iter;
+	}
+	const KeyEntry &entry = iter == key_index_.rend() ? key_index_.front() : *iter;
+	pos = entry.pos;
+	actual_offset_us = now - entry.wall_us;
+	return true;
+}
+
+const std::string &DvrBuffer::Path() const
+{
+	return writer_.Path();
+}
+
+void DvrBuffer::Prune(int64_t now_us)
+{
+	if (writer_.Path().empty() || key_index_.empty())
+	{
+		return;
+	}
+	//keep a quarter of the ring as margin, the writer is still going while a playback seeks
+	uint64_t write_pos = writer_.WritePos();
+	uint64_t usable = writer_.Capacity() / 4 * 3;
+	while (!key_index_.empty() && (write_pos - key_index_.front().pos > usable || now_us - key_index_.front().wall_us > window_us_))
+	{
+		key_index_.pop_front();
+	}
+}
+
+DvrPlayback::DvrPlayback(const std::shared_ptr<DvrBuffer> &dvr, uint64_t pos, double speed, const std::string &output_url)
+	: dvr_(dvr), pos_(pos), speed_(speed > 0 ? speed : 1), output_url_(output_url), output_guard_(&running_, output_url)
+{
+}
+
+std::string DvrPlayback::dstUrl() const
+{
+	return output_url_;
+}
+
+bool DvrPlayback::running() const
+{
+	return running_.load();
+}
+
+void DvrPlayback::stop()
+{
+	running_.store(false);
+}
+
+extern std::string g_oformat;
+extern int g_write_timeout_ms;
+void DvrPlayback::start()
+{
+	ShmPacketReader reader;
+	std::string erroStr;
+	if (!reader.Open(dvr_->Path(), erroStr))
+	{
+		spdlog::error("DvrPlayback {} {}", output_url_, erroStr);
+		running_.store(false);
+		return;
+	}
+	reader.Seek(pos_);
+
+	ShmStreamParams params[kShmMaxStreams];
+	int nb_streams = reader.Params(params, kShmMaxStreams);
+	bool has_video = false;
+	for (int i = 0; i < nb_streams; i++)
+	{
+		has_video |= params[i].codec_type == AVMEDIA_TYPE_VIDEO;
+	}
+
+	AVFormatContext *output_format = NULL;
+	int ret = avformat_alloc_output_context2(&output_format, NULL, g_oformat.data(), output_url_.c_str());
+	if (ret < 0 || !output_format)
+	{
+		spdlog::error("DvrPlayback {} avformat_alloc_output_context2 failed error: {}", output_url_, av_err2str(ret));
+		running_.store(false);
+		return;
+	}
+	output_format->interrupt_callback.callback = &OutputGuard::Callback;
+	output_format->interrupt_callback.opaque = &output_guard_;
+
+	for (int i = 0; i < nb_streams; i++)
+	{
+		AVStream *out_stream = avformat_new_stream(output_format, NULL);
+		AVCodecParameters *par = out_stream->codecpar;
+		par->codec_type = (AVMediaType)params[i].codec_type;
+		par->codec_id = (AVCodecID)params[i].codec_id;
+		par->codec_tag = 0;
+		par->format = params[i].format;
+		par->bit_rate = params[i].bit_rate;
+		par->profile = params[i].profile;
+		par->level = params[i].level;
+		par->width = params[i].width;
+		par->height = params[i].height;
+		par->sample_aspect_ratio = AVRational{params[i].sample_aspect_num, params[i].sample_aspect_den};
+		par->channels = params[i].channels;
+		par->sample_rate = params[i].sample_rate;
+		par->channel_layout = params[i].channel_layout;
+		par->frame_size = params[i].frame_size;
+		if (params[i].extradata_size)
+		{
+			par->extradata = (uint8_t *)av_mallocz(params[i].extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+			memcpy(par->extradata, params[i].extradata, params[i].extradata_size);
+			par->extradata_size = params[i].extradata_size;
+		}
+		out_stream->time_base = AVRational{params[i].time_base_num, params[i].time_base_den};
+	}
+
+	if (!(output_format->oformat->flags & AVFMT_NOFILE))
+	{
+		output_guard_.Arm("publish open", g_write_timeout_ms);
+		ret = output_guard_.Done(avio_open2(&output_format->pb, output_url_.c_str(), AVIO_FLAG_WRITE, &output_format->interrupt_callback, NULL));
+		if (ret < 0)
+		{
+			spdlog::error("DvrPlayback {} avio_open output failed error: {}", output_url_, av_err2str(ret));
+			avformat_free_context(output_format);
+			running_.store(false);
+			return;
+		}
+	}
+	output_guard_.Arm("publish header", g_write_timeout_ms);
+	ret = output_guard_.Done(avformat_write_header(output_format, NULL));
+	if (ret < 0)
+	{
+		spdlog::error("DvrPlayback {} avformat_write_header failed error: {}", output_url_, av_err2str(ret));
+		if (!(output_format->oformat->flags & AVFMT_NOFILE))
+		{
+			avio_close(output_format->pb);
+		}
+		avformat_free_context(output_format);
+		running_.store(false);
+		return;
+	}
+
+	//output timestamps start at 0 and stay continuous when the reader is lapped and jumps ahead
+	bool caught_up = false, waiting_key = true, rebase = true;
+	int64_t ts_offset = 0, next_dts = 0, anchor_wall = 0, anchor_dts = 0;
+	int64_t packets = 0;
+	while (running_.load())
+	{
+		ShmPacketView view;
+		ShmPacketReader::Result result = reader.Next(view);
+		if (result == ShmPacketReader::kClosed)
+		{
+			break;
+		}
+		else if (result == ShmPacketReader::kEmpty)
+		{
+			//at the live edge the source paces the output
+			if (!caught_up)
+			{
+				spdlog::info("DvrPlayback {} caught up with live after {} packets", output_url_, packets);
+				caught_up = true;
+			}
+			av_usleep(5000);
+			continue;
+		}
+		else if (result == ShmPacketReader::kLapped)
+		{
+			spdlog::warn("DvrPlayback {} overtaken by the live writer, skip to live", output_url_);
+			waiting_key = rebase = caught_up = true;
+			continue;
+		}
+
+		const ShmPacketHeader &hdr = view.header;
+		if (hdr.stream_index >= nb_streams)
+		{
+			continue;
+		}
+		const ShmStreamParams &in_params = params[hdr.stream_index];
+		bool key = (hdr.flags & AV_PKT_FLAG_KEY) && (!has_video || in_params.codec_type == AVMEDIA_TYPE_VIDEO);
+		if (waiting_key && !key)
+		{
+			continue;
+		}
+
+		AVPacket packet;
+		av_init_packet(&packet);
+		if (av_new_packet(&packet, hdr.size) < 0)
+		{
+			break;
+		}
+		memcpy(packet.data, view.data, hdr.size);
+		if (!reader.Valid(view))
+		{
+			av_packet_unref(&packet);
+			waiting_key = rebase = true;
+			continue;
+		}
+		waiting_key = false;
+
+		AVRational in_time_base = AVRational{in_params.time_base_num, in_params.time_base_den};
+		AVStream *out_stream = output_format->streams[hdr.stream_index];
+		int64_t dts = hdr.dts != AV_NOPTS_VALUE ? hdr.dts : hdr.pts;
+		int64_t dts_us = dts != AV_NOPTS_VALUE ? av_rescale_q(dts, in_time_base, AV_TIME_BASE_Q) : next_dts + ts_offset;
+		int64_t now = av_gettime_relative();
+		if (rebase)
+		{
+			ts_offset = dts_us - next_dts;
+			anchor_wall = now;
+			anchor_dts = dts_us;
+			rebase = false;
+		}
+
+		if (!caught_up)
+		{
+			int64_t target = anchor_wall + int64_t((dts_us - anchor_dts) / speed_);
+			if (target > now)
+			{
+				av_usleep(target - now);
+			}
+		}
+
+		int64_t out_dts = dts_us - ts_offset;
+		next_dts = std::max(next_dts, out_dts + 1);
+		packet.stream_index = hdr.stream_index;
+		packet.flags = hdr.flags;
+		packet.pts = hdr.pts != AV_NOPTS_VALUE ? av_rescale_q(av_rescale_q(hdr.pts, in_time_base, AV_TIME_BASE_Q) - ts_offset, AV_TIME_BASE_Q, out_stream->time_base) : AV_NOPTS_VALUE;
+		packet.dts = dts != AV_NOPTS_VALUE ? av_rescale_q(out_dts, AV_TIME_BASE_Q, out_stream->time_base) : AV_NOPTS_VALUE;
+		packet.duration = av_rescale_q(hdr.duration, in_time_base, out_stream->time_base);
+		output_guard_.Arm("publish write", g_write_timeout_ms);
+		ret = output_guard_.Done(av_write_frame(output_format, &packet));
+		av_packet_unref(&packet);
+		if (ret < 0)
+		{
+			//the output is gone, nobody would ever stop this playback otherwise
+			spdlog::error("DvrPlayback {} av_write_frame failed error: {}", output_url_, av_err2str(ret));
+			break;
+		}
+		packets++;
+	}
+
+	output_guard_.Arm("publish trailer", g_write_timeout_ms);
+	av_write_trailer(output_format);
+	if (!(output_format->oformat->flags & AVFMT_NOFILE))
+	{
+		avio_close(output_format->pb);
+	}
+	output_guard_.Done(0);
+	avformat_free_context(output_format);
+	spdlog::info("DvrPlayback {} finished, {} packets", output_url_, packets);
+	running_.store(false);
+}
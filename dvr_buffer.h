@@ -0,0 +1,62 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "shm_packet_ring.h"
+#include "stall_watchdog.h"
+
+//Rolling time-shift buffer of one session. Packets go into a ShmPacketWriter ring backed by a regular
+//file, so the buffer lives in the page cache instead of the heap, plus a small index of key frames
+//used to start playback at "now minus offset".
+class DvrBuffer
+{
+public:
+    DvrBuffer() = default;
+    ~DvrBuffer();
+    bool Create(const std::string &path, uint64_t capacity, int64_t window_us, std::string &err);
+    void SetParams(const ShmStreamParams *streams, int nb_streams);
+    //key marks a point playback may start from
+    void Write(const ShmPacketHeader &pkt, const uint8_t *data, bool key);
+    //the live session ended, playbacks drain what is left and stop
+    void Close();
+    //ring position of the last key frame at least offset_us old, clamped to the oldest one kept
+    bool Locate(int64_t offset_us, uint64_t &pos, int64_t &actual_offset_us);
+    const std::string &Path() const;
+    //removes the <hash>-<pid>-<seq>.dvr files in dir whose process is gone, a crash leaves them behind
+    static void Sweep(const std::string &dir);
+
+private:
+    struct KeyEntry
+    {
+        int64_t wall_us;
+        uint64_t pos;
+    };
+    void Prune(int64_t now_us);
+
+    ShmPacketWriter writer_;
+    int64_t window_us_ = 0;
+    std::mutex mtx_;
+    std::deque<KeyEntry> key_index_;
+};
+
+//Plays a DvrBuffer from a key frame to a new output, faster than realtime until it reaches the live
+//edge and at the pace of the source from then on.
+class DvrPlayback
+{
+public:
+    DvrPlayback(const std::shared_ptr<DvrBuffer> &dvr, uint64_t pos, double speed, const std::string &output_url);
+    void start();
+    void stop();
+    bool running() const;
+    std::string dstUrl() const;
+
+private:
+    std::shared_ptr<DvrBuffer> dvr_;
+    uint64_t pos_;
+    double speed_;
+    std::string output_url_;
+    std::atomic_bool running_{true};
+    OutputGuard output_guard_;
+};
@@ -0,0 +1,113 @@
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+#include "frame_thinner.h"
+
+FrameThinner::FrameThinner(const AVCodecParameters *par, int every) : codec_id_(par->codec_id), every_(every < 1 ? 1 : every)
+{
+	//avcC keeps lengthSizeMinusOne in byte 4, hvcC in byte 21, Annex B extradata starts with a start code
+	if (par->extradata_size > 0 && par->extradata[0] == 1)
+	{
+		if (codec_id_ == AV_CODEC_ID_H264 && par->extradata_size > 4)
+		{
+			length_size_ = (par->extradata[4] & 3) + 1;
+		}
+		else if (codec_id_ == AV_CODEC_ID_HEVC && par->extradata_size > 21)
+		{
+			length_size_ = (par->extradata[21] & 3) + 1;
+		}
+	}
+}
+
+bool FrameThinner::Keep(const AVPacket *packet)
+{
+	if (packet->flags & AV_PKT_FLAG_KEY)
+	{
+		seen_key_ = true;
+		since_key_ = 0;
+		return true;
+	}
+	//nothing before the first key frame can be decoded
+	if (!seen_key_ || every_ == 1)
+	{
+		return false;
+	}
+
+	since_key_++;
+	if (since_key_ % every_ == 0)
+	{
+		return true;
+	}
+	return IsReference(packet->data, packet->size);
+}
+
+bool FrameThinner::IsReference(const uint8_t *data, int size) const
+{
+	//other codecs carry no reference information we can read cheaply, nothing is dropped
+	if (codec_id_ != AV_CODEC_ID_H264 && codec_id_ != AV_CODEC_ID_HEVC)
+	{
+		return true;
+	}
+
+	if (length_size_)
+	{
+		int pos = 0;
+		while (pos + length_size_ <= size)
+		{
+			int64_t nal_size = 0;
+			for (int i = 0; i < length_size_; i++)
+			{
+				nal_size = (nal_size << 8) | data[pos + i];
+			}
+			pos += length_size_;
+			if (nal_size <= 0 || nal_size > size - pos)
+			{
+				return true;
+			}
+			if (IsReferenceNal(data + pos, nal_size))
+			{
+				return true;
+			}
+			pos += nal_size;
+		}
+		return false;
+	}
+
+	//Annex B: every NAL follows a 00 00 01 start code, the 4 byte form ends the same way
+	for (int pos = 0; pos + 3 < size; pos++)
+	{
+		if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1)
+		{
+			pos += 3;
+			if (IsReferenceNal(data + pos, size - pos))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+//only slice NALs decide, parameter sets and SEI say nothing about references
+bool FrameThinner::IsReferenceNal(const uint8_t *nal, int size) const
+{
+	if (size < 1)
+	{
+		return false;
+	}
+	if (codec_id_ == AV_CODEC_ID_H264)
+	{
+		int type = nal[0] & 0x1f;
+		bool slice = type >= 1 && type <= 5;
+		return slice && (nal[0] >> 5) & 3;
+	}
+
+	int type = (nal[0] >> 1) & 0x3f;
+	//VCL types 0..14 are sub-layer non-reference when even, 16..31 are IRAP and reserved IRAP types
+	if (type > 31)
+	{
+		return false;
+	}
+	return type > 14 || (type & 1);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+struct AVCodecParameters;
+struct AVPacket;
+
+//Decides per video packet whether a thinned output keeps it, without decoding. every 1 keeps key frames
+//only; every N > 1 also keeps every Nth frame after a key frame, but only where the frames skipped in
+//between are non-reference (H.264 nal_ref_idc 0, HEVC sub-layer non-reference NAL types). A reference
+//frame is always kept, dropping it would break every frame after it up to the next key frame.
+class FrameThinner
+{
+public:
+    FrameThinner(const AVCodecParameters *par, int every);
+    bool Keep(const AVPacket *packet);
+
+private:
+    bool IsReference(const uint8_t *data, int size) const;
+    bool IsReferenceNal(const uint8_t *nal, int size) const;
+
+    int codec_id_;
+    int every_;
+    int length_size_ = 0; //NAL length prefix of avcC/hvcC packets, 0 for Annex B start codes
+    int64_t since_key_ = 0;
+    bool seen_key_ = false;
+};
@@ -0,0 +1,73 @@
+#include "hash_ring.h"
+
+HashRing::HashRing(int replicas) : replicas_(replicas > 0 ? replicas : 1)
+{
+}
+
+void HashRing::AddNode(const std::string &node)
+{
+    if (!nodes_.insert(node).second)
+    {
+        return;
+    }
+    for (int i = 0; i < replicas_; i++)
+    {
+        ring_.insert(std::make_pair(Hash(node + "#" + std::to_string(i)), node));
+    }
+}
+
+void HashRing::RemoveNode(const std::string &node)
+{
+    if (!nodes_.erase(node))
+    {
+        return;
+    }
+    for (auto iter = ring_.begin(); iter != ring_.end();)
+    {
+        if (iter->second == node)
+            iter = ring_.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+bool HashRing::HasNode(const std::string &node) const
+{
+    return nodes_.find(node) != nodes_.end();
+}
+
+std::string HashRing::Owner(const std::string &key) const
+{
+    if (ring_.empty())
+    {
+        return std::string();
+    }
+    auto iter = ring_.lower_bound(Hash(key));
+    if (iter == ring_.end())
+    {
+        iter = ring_.begin();
+    }
+    return iter->second;
+}
+
+const std::set<std::string> &HashRing::Nodes() const
+{
+    return nodes_;
+}
+
+uint64_t HashRing::Hash(const std::string &key)
+{
+    //FNV-1a followed by the murmur3 finalizer, plain FNV clusters similar urls
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
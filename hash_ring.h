@@ -0,0 +1,25 @@
+#pragma once
+#include <map>
+#include <set>
+#include <string>
+#include <cstdint>
+
+//consistent hash ring, every node is placed on the ring replicas times so keys spread evenly
+//and removing a node only moves the keys it owned
+class HashRing
+{
+public:
+    explicit HashRing(int replicas = 160);
+    void AddNode(const std::string &node);
+    void RemoveNode(const std::string &node);
+    bool HasNode(const std::string &node) const;
+    std::string Owner(const std::string &key) const;
+    const std::set<std::string> &Nodes() const;
+    //stable across processes and builds, std::hash is not
+    static uint64_t Hash(const std::string &key);
+
+private:
+    int replicas_;
+    std::map<uint64_t, std::string> ring_;
+    std::set<std::string> nodes_;
+};
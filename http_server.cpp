@@ -1,6 +1,13 @@
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <future>
+#include <sstream>
 #include <boost/archive/iterators/base64_from_binary.hpp>
 #include <boost/archive/iterators/binary_from_base64.hpp>
 #include <boost/archive/iterators/transform_width.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <cpprest/http_client.h>
 #include "spdlog/spdlog.h"
 #include "Poco/Net/HTMLForm.h"
 #include "Poco/Net/HTTPRequest.h"
@@ -8,7 +15,9 @@
 #include "Poco/StreamCopier.h"
 #include "http_server.h"
 #include "transform_stream_api.h"
-#include "timercpp.h"
+#include "admission_control.h"
+#include "cluster.h"
+#include "process_monitor.h"
 
 namespace Poco
 {
@@ -94,20 +103,24 @@ HttpServer::HttpServer(const std::string &host, const int thr_num) : io_service_
         }));
     }
     quit_.store(false);
-    io_service_.post(std::bind(&HttpServer::ClearDeadStream, this));
     listener_ = http_listener(host);
     listener_.support(std::bind(&HttpServer::OnRequest, this, std::placeholders::_1));
     handler_map_.insert(std::make_pair("/rest/api/v1/transform_stream", std::bind(&HttpServer::HandStart, this, std::placeholders::_1)));
     handler_map_.insert(std::make_pair("/rest/api/v1/stop", std::bind(&HttpServer::HandStop, this, std::placeholders::_1)));
+    handler_map_.insert(std::make_pair("/rest/api/v1/capacity", std::bind(&HttpServer::HandCapacity, this, std::placeholders::_1)));
+    handler_map_.insert(std::make_pair("/rest/api/v1/sessions", std::bind(&HttpServer::HandSessions, this, std::placeholders::_1)));
+    handler_map_.insert(std::make_pair("/rest/api/v1/replay", std::bind(&HttpServer::HandReplay, this, std::placeholders::_1)));
+    handler_map_.insert(std::make_pair("/rest/api/v1/stats", std::bind(&HttpServer::HandStats, this, std::placeholders::_1)));
 }
 
 HttpServer::~HttpServer()
 {
     quit_.store(true);
     io_service_.stop();
-    while (!io_service_.stopped())
+    //a joinable std::thread left behind terminates the process
+    for (auto &thr : threads_vec_)
     {
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        thr.join();
     }
 }
 
@@ -131,6 +144,24 @@ void HttpServer::SetTransformApi(const std::shared_ptr<TransformStreamApi> &ptr)
     transform_api_ = ptr;
 }
 
+void HttpServer::SetAdmissionControl(const std::shared_ptr<AdmissionControl> &ptr)
+{
+    admission_ = ptr;
+}
+
+void HttpServer::SetProcessMonitor(const std::shared_ptr<ProcessMonitor> &ptr)
+{
+    monitor_ = ptr;
+}
+
+void HttpServer::SetCluster(const std::shared_ptr<Cluster> &ptr)
+{
+    cluster_ = ptr;
+    cluster_->Run(std::bind(&HttpServer::LocalSessions, this, std::placeholders::_1),
+                  std::bind(&HttpServer::RestoreSession, this, std::placeholders::_1),
+                  std::bind(&HttpServer::ReleaseSession, this, std::placeholders::_1));
+}
+
 std::vector<std::string> HttpServer::StringSplit(const std::string &s, const std::string &delim)
 {
     std::vector<std::string> ret;
@@ -153,6 +184,17 @@ void HttpServer::OnRequest(http_request message)
     std::string url_path = message.relative_uri().path();
     spdlog::info("Received request, path: {}", url_path);
 
+    //latency up to the reply, transform_stream replies only after the first frame
+    if (monitor_)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        std::shared_ptr<ProcessMonitor> monitor = monitor_;
+        message.get_response().then([monitor, url_path, begin](pplx::task<http_response>) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+            monitor->RecordLatency(url_path, elapsed.count());
+        });
+    }
+
     if (message.method() == methods::POST || message.method() == methods::GET)
     {
         io_service_.post([=] {
@@ -221,99 +263,566 @@ void HttpServer::OnRequest(http_request message)
 
 void HttpServer::HandStart(http_request message)
 {
-    io_service_.post([=] {
-        try
+    auto result = uri::split_query(message.relative_uri().query());
+    auto iter = result.find("url");
+    if (iter == result.end())
+    {
+        auto response = json::value::object();
+        response["status"] = 404;
+        response["message"] = json::value::string("url not find");
+        message.reply(status_codes::NotFound, response);
+        return;
+    }
+    std::string input_url = iter->second;
+    if (RouteToOwner(message, input_url))
+    {
+        return;
+    }
+    
+    iter = result.find("auto-replay");
+    bool auto_replay = false;
+    if(iter != result.end())
+    {
+        auto_replay = true;
+    }
+
+    TransformOptions options;
+    iter = result.find("shm");
+    if (iter != result.end())
+    {
+        options.shm_name = iter->second;
+        bool valid = !options.shm_name.empty() && options.shm_name.size() < 200 && options.shm_name[0] != '.' &&
+                     std::all_of(options.shm_name.begin(), options.shm_name.end(), [](char c) { return isalnum(c) || c == '_' || c == '-' || c == '.'; });
+        if (!valid)
+        {
+            auto response = json::value::object();
+            response["status"] = 20001;
+            response["message"] = json::value::string("invalid shm name, use [A-Za-z0-9_.-]");
+            message.reply(status_codes::BadRequest, response);
+            return;
+        }
+    }
+
+    iter = result.find("dvr");
+    if (iter != result.end())
+    {
+        options.dvr_minutes = std::max(0, std::atoi(iter->second.c_str()));
+    }
+
+    //backup sources in failover order, separated by '|'
+    iter = result.find("backup_url");
+    if (iter != result.end())
+    {
+        std::stringstream ss(iter->second);
+        std::string backup_url;
+        while (std::getline(ss, backup_url, '|'))
+        {
+            if (!backup_url.empty() && backup_url != input_url)
+                options.backup_urls.push_back(backup_url);
+        }
+    }
+
+    iter = result.find("standby");
+    if (iter != result.end())
+    {
+        options.standby = iter->second == "true" || iter->second == "1";
+    }
+
+    //thin=key or thin=N for low-bandwidth previews, the shm ring and the dvr still get every packet
+    iter = result.find("thin");
+    if (iter != result.end())
+    {
+        options.thin = iter->second == "key" ? 1 : std::max(0, std::atoi(iter->second.c_str()));
+    }
+
+    iter = result.find("video_only");
+    if (iter != result.end())
+    {
+        options.video_only = iter->second == "true" || iter->second == "1";
+    }
+
+    //a session that would be replayed anyway first reopens its input behind the running output
+    options.reconnect = auto_replay;
+
+    //an existing transform costs nothing more, only new ones are subject to admission
+    std::vector<TransformSessionInfo> infos;
+    bool complete = transform_api_->sessions(infos);
+    auto existing_iter = std::find_if(infos.begin(), infos.end(), [&](const TransformSessionInfo &info) { return info.input_url == input_url; });
+    bool existing = existing_iter != infos.end();
+    //a joined session keeps the options it was started with, a new one must not take another's ring
+    std::string shm_name = existing ? existing_iter->shm_name : options.shm_name;
+    //the ring could belong to a session of a worker that did not answer
+    if (!existing && !complete && !options.shm_name.empty())
+    {
+        auto response = json::value::object();
+        response["status"] = 20001;
+        response["message"] = json::value::string("session list incomplete, shm " + options.shm_name + " can not be checked");
+        http_response reply(status_codes::ServiceUnavailable);
+        reply.headers().add(header_names::retry_after, admission_ ? admission_->RetryAfter() : 1);
+        reply.set_body(response);
+        message.reply(reply);
+        return;
+    }
+    if (!existing && !options.shm_name.empty() &&
+        std::any_of(infos.begin(), infos.end(), [&](const TransformSessionInfo &info) { return info.shm_name == options.shm_name; }))
+    {
+        auto response = json::value::object();
+        response["status"] = 20001;
+        response["message"] = json::value::string("shm " + options.shm_name + " is used by another transform");
+        message.reply(status_codes::Conflict, response);
+        return;
+    }
+    std::string reject_reason;
+    if (!existing && admission_ && !admission_->Admit(input_url, infos, complete, reject_reason))
+    {
+        auto response = json::value::object();
+        response["status"] = 20001;
+        response["message"] = json::value::string(reject_reason);
+        http_response reply(status_codes::ServiceUnavailable);
+        reply.headers().add(header_names::retry_after, admission_->RetryAfter());
+        reply.set_body(response);
+        message.reply(reply);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(replay_mtx_);
+        if (auto_replay)
+            auto_replay_urls_.insert(input_url);
+        else
+            auto_replay_urls_.erase(input_url);
+        if (!existing)
+            session_options_[input_url] = options;
+    }
+
+    //the admitted capacity stays reserved until the first frame or the failure
+    auto reserved = std::make_shared<std::atomic_bool>(!existing && admission_);
+    std::string out_url, err;
+    iter = result.find("output_url");
+    if (iter != result.end())
+    {
+        out_url = iter->second;
+    }
+    //replies from the session thread once the first frame is read or the open failed, concurrent
+    //requests for the same source share that one open
+    transform_api_->start(input_url, out_url, options, [this, message, input_url, auto_replay, shm_name, reserved](int code, const std::string out_url, const std::string &err) -> void {
+        if (reserved->exchange(false))
+        {
+            admission_->Release(input_url);
+        }
+        if (code == -1)
+        {
+            auto response = json::value::object();
+            response["status"] = 20001;
+            response["message"] = json::value::string(err);
+            message.reply(status_codes::OK, response);
+        }
+        else if (code == 0)
         {
-            auto result = uri::split_query(message.relative_uri().query());
-            auto iter = result.find("url");
-            if (iter == result.end())
+            auto response = json::value::object();
+            response["status"] = 200;
+            response["message"] = json::value::string(err);
+            response["data"] = json::value::string(out_url);
+            if (!shm_name.empty())
             {
-                auto response = json::value::object();
-                response["status"] = 404;
-                response["message"] = json::value::string("url not find");
-                message.reply(status_codes::NotFound, response);
+                response["shm"] = json::value::string(shm_name);
             }
-            std::string input_url = iter->second;
-            
-            iter = result.find("auto-replay");
-            bool auto_replay = false;
-            if(iter != result.end())
+            message.reply(status_codes::OK, response);
+        }
+        else if (code == -2 && auto_replay)
+        {
+            io_service_.post(std::bind(&HttpServer::ReplayDeadStream, this, input_url, out_url, std::chrono::steady_clock::now()));
+        }
+    });
+}
+
+void HttpServer::HandStop(http_request message)
+{
+    auto result = uri::split_query(message.relative_uri().query());
+    auto iter = result.find("url");
+    if (iter == result.end())
+    {
+        auto response = json::value::object();
+        response["status"] = 404;
+        response["message"] = json::value::string("url not find");
+        message.reply(status_codes::NotFound, response);
+        return;
+    }
+
+    std::string input_url = iter->second;
+    if (RouteToOwner(message, input_url))
+    {
+        return;
+    }
+
+    //answered once the session stopped publishing, the http thread does not wait for it
+    auto reply = [message](const std::string &erroStr) {
+        auto response = json::value::object();
+        if (erroStr.empty())
+        {
+            response["status"] = 200;
+            response["message"] = json::value::string("successful");
+        }
+        else
+        {
+            response["status"] = 20001;
+            response["message"] = json::value::string(erroStr);
+        }
+        message.reply(status_codes::OK, response);
+    };
+    //a dvr replay is stopped through the source it plays from, so it routes to the same node
+    iter = result.find("replay");
+    if (iter != result.end())
+    {
+        transform_api_->stop(iter->second, reply);
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(replay_mtx_);
+            auto_replay_urls_.erase(input_url);
+            session_options_.erase(input_url);
+        }
+        transform_api_->stop(input_url, reply);
+    }
+}
+
+void HttpServer::HandCapacity(http_request message)
+{
+    auto resource_json = [](const AdmissionResource &res) {
+        auto obj = json::value::object();
+        obj["used"] = json::value::number(res.used);
+        obj["budget"] = json::value::number(res.budget);
+        obj["headroom"] = json::value::number(res.headroom);
+        return obj;
+    };
+
+    auto response = json::value::object();
+    if (!admission_)
+    {
+        response["status"] = 20001;
+        response["message"] = json::value::string("admission control disabled");
+        message.reply(status_codes::OK, response);
+        return;
+    }
+
+    AdmissionUsage usage = admission_->Usage();
+    auto data = json::value::object();
+    data["accepting"] = json::value::boolean(usage.accepting);
+    data["pending"] = json::value::number(usage.pending);
+    data["reason"] = json::value::string(usage.reason);
+    data["sessions"] = resource_json(usage.sessions);
+    data["cpu"] = resource_json(usage.cpu);
+    data["input_kbps"] = resource_json(usage.input_kbps);
+    data["rss_mb"] = resource_json(usage.rss_mb);
+    data["memory_mb"] = resource_json(usage.memory_mb);
+    response["status"] = 200;
+    response["message"] = json::value::string("successful");
+    response["data"] = data;
+    message.reply(status_codes::OK, response);
+}
+
+void HttpServer::HandStats(http_request message)
+{
+    auto response = json::value::object();
+    if (!monitor_)
+    {
+        response["status"] = 20001;
+        response["message"] = json::value::string("process monitor disabled");
+        message.reply(status_codes::OK, response);
+        return;
+    }
+
+    std::vector<ProcessSample> samples;
+    monitor_->Samples(samples);
+    auto samples_json = json::value::array(samples.size());
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        auto item = json::value::object();
+        item["uptime"] = json::value::number(samples[i].uptime_s);
+        item["rss_kb"] = json::value::number(samples[i].rss_kb);
+        item["threads"] = json::value::number(samples[i].threads);
+        item["fds"] = json::value::number(samples[i].fds);
+        item["sessions"] = json::value::number(samples[i].sessions);
+        samples_json[i] = item;
+    }
+
+    std::map<std::string, LatencyStats> latencies;
+    monitor_->Latencies(latencies);
+    auto latency_json = json::value::object();
+    for (auto &item : latencies)
+    {
+        auto stats = json::value::object();
+        stats["count"] = json::value::number(item.second.count);
+        stats["p50_ms"] = json::value::number(item.second.p50_ms);
+        stats["p99_ms"] = json::value::number(item.second.p99_ms);
+        latency_json[item.first] = stats;
+    }
+
+    ProcessGrowth growth = monitor_->Growth();
+    auto growth_json = json::value::object();
+    growth_json["rss"] = json::value::boolean(growth.rss);
+    growth_json["threads"] = json::value::boolean(growth.threads);
+    growth_json["fds"] = json::value::boolean(growth.fds);
+
+    auto data = json::value::object();
+    data["samples"] = samples_json;
+    data["latency"] = latency_json;
+    data["growing"] = growth_json;
+    data["leak_suspected"] = json::value::boolean(growth.rss || growth.threads || growth.fds);
+    response["status"] = 200;
+    response["message"] = json::value::string("successful");
+    response["data"] = data;
+    message.reply(status_codes::OK, response);
+}
+
+void HttpServer::HandSessions(http_request message)
+{
+    std::vector<TransformSessionInfo> infos;
+    bool complete = transform_api_->sessions(infos);
+
+    auto data = json::value::array(infos.size());
+    std::lock_guard<std::mutex> lock(replay_mtx_);
+    for (size_t i = 0; i < infos.size(); i++)
+    {
+        auto item = json::value::object();
+        item["url"] = json::value::string(infos[i].input_url);
+        item["output_url"] = json::value::string(infos[i].output_url);
+        item["input_bitrate"] = json::value::number(infos[i].input_bitrate);
+        item["auto_replay"] = json::value::boolean(auto_replay_urls_.find(infos[i].input_url) != auto_replay_urls_.end());
+        item["shm"] = json::value::string(infos[i].shm_name);
+        item["dvr"] = json::value::number(infos[i].dvr_minutes);
+        item["active_url"] = json::value::string(infos[i].active_url);
+        item["thin"] = json::value::number(infos[i].thin);
+        //what the source was started with, a node taking it over starts it the same way
+        auto options_iter = session_options_.find(infos[i].input_url);
+        auto backups = json::value::array();
+        bool standby = false, video_only = false;
+        if (options_iter != session_options_.end())
+        {
+            const TransformOptions &options = options_iter->second;
+            backups = json::value::array(options.backup_urls.size());
+            for (size_t j = 0; j < options.backup_urls.size(); j++)
             {
-                auto_replay = true;
+                backups[j] = json::value::string(options.backup_urls[j]);
             }
+            standby = options.standby;
+            video_only = options.video_only;
+        }
+        item["backup_urls"] = backups;
+        item["standby"] = json::value::boolean(standby);
+        item["video_only"] = json::value::boolean(video_only);
+        item["reconnects"] = json::value::number(infos[i].reconnects);
+        item["last_reconnect_ms"] = json::value::number(infos[i].last_reconnect_ms);
+        auto memory = json::value::object();
+        memory["total"] = json::value::number(infos[i].memory_packet + infos[i].memory_avio + infos[i].memory_cache + infos[i].memory_ring);
+        memory["packet"] = json::value::number(infos[i].memory_packet);
+        memory["avio"] = json::value::number(infos[i].memory_avio);
+        memory["cache"] = json::value::number(infos[i].memory_cache);
+        memory["ring"] = json::value::number(infos[i].memory_ring);
+        item["memory"] = memory;
+        data[i] = item;
+    }
 
-            std::string out_url, err;
-            transform_api_->start(input_url, out_url, [&, message, input_url, auto_replay](int code, const std::string out_url, const std::string &err) -> void {
-                if (code == -1)
-                {
-                    auto response = json::value::object();
-                    response["status"] = 20001;
-                    response["message"] = json::value::string(err);
-                    message.reply(status_codes::OK, response);
+    auto response = json::value::object();
+    response["status"] = 200;
+    response["message"] = json::value::string("successful");
+    response["data"] = data;
+    //a worker that did not answer left its sessions out, they are not gone
+    response["incomplete"] = json::value::boolean(!complete);
+    message.reply(status_codes::OK, response);
+}
 
-                    std::lock_guard<std::mutex> lock(url_mtx_);
-                    dead_video_param_ = std::make_pair(input_url, "");
-                    cv_.notify_one();
-                }
-                else if (code == 0)
+void HttpServer::HandReplay(http_request message)
+{
+    auto result = uri::split_query(message.relative_uri().query());
+    auto iter = result.find("url");
+    if (iter == result.end())
+    {
+        auto response = json::value::object();
+        response["status"] = 404;
+        response["message"] = json::value::string("url not find");
+        message.reply(status_codes::NotFound, response);
+        return;
+    }
+    std::string input_url = iter->second;
+    if (RouteToOwner(message, input_url))
+    {
+        return;
+    }
+
+    //offset in seconds back from live, speed while catching up
+    auto parse = [&result](const char *name, double default_value, double &value) {
+        auto iter = result.find(name);
+        if (iter == result.end())
+        {
+            value = default_value;
+            return true;
+        }
+        char *end = nullptr;
+        value = std::strtod(iter->second.c_str(), &end);
+        return !iter->second.empty() && *end == '\0' && std::isfinite(value);
+    };
+    double offset = 0, speed = 4;
+    if (!parse("offset", 0, offset) || !parse("speed", 4, speed) || offset < 0 || speed <= 0)
+    {
+        auto response = json::value::object();
+        response["status"] = 20001;
+        response["message"] = json::value::string("invalid offset or speed");
+        message.reply(status_codes::BadRequest, response);
+        return;
+    }
+    int64_t offset_ms = int64_t(std::min(offset, 86400.0) * 1000);
+
+    std::string out_url, err;
+    transform_api_->replay(input_url, offset_ms, speed, out_url, err);
+    auto response = json::value::object();
+    if (err.empty())
+    {
+        response["status"] = 200;
+        response["message"] = json::value::string("successful");
+        response["data"] = json::value::string(out_url);
+    }
+    else
+    {
+        response["status"] = 20001;
+        response["message"] = json::value::string(err);
+    }
+    message.reply(status_codes::OK, response);
+}
+
+bool HttpServer::RouteToOwner(http_request message, const std::string &input_url)
+{
+    //requests already forwarded by a peer are always served here, so rings that disagree can not loop
+    if (!cluster_ || message.headers().has(Cluster::kForwardHeader))
+    {
+        return false;
+    }
+    std::string owner = cluster_->Owner(input_url);
+    if (owner.empty() || cluster_->IsSelf(owner))
+    {
+        return false;
+    }
+
+    std::string target = owner + message.relative_uri().to_string();
+    spdlog::trace("{} owned by {}, route to {}", input_url, owner, target);
+    if (cluster_->Redirect())
+    {
+        auto response = json::value::object();
+        response["status"] = 307;
+        response["message"] = json::value::string(owner);
+        http_response reply(status_codes::TemporaryRedirect);
+        reply.headers().add(header_names::location, target);
+        reply.set_body(response);
+        message.reply(reply);
+        return true;
+    }
+
+    auto client = std::make_shared<client::http_client>(owner);
+    http_request forward(message.method());
+    forward.set_request_uri(message.relative_uri());
+    forward.headers().add(Cluster::kForwardHeader, cluster_->Self());
+    auto bad_gateway = [message, owner](const std::exception &e) {
+        auto response = json::value::object();
+        response["status"] = 20001;
+        response["message"] = json::value::string(owner + " unreachable: " + e.what());
+        message.reply(status_codes::BadGateway, response);
+        spdlog::error("HttpServer forward to {} failed: {}", owner, e.what());
+    };
+    client->request(forward).then([client, message, bad_gateway](pplx::task<http_response> task) {
+        try
+        {
+            http_response response = task.get();
+            //the owner's reply goes back unchanged, Retry-After of a 503 included, whatever the body is
+            response.extract_vector().then([message, response, bad_gateway](pplx::task<std::vector<unsigned char>> body) {
+                try
                 {
-                    auto response = json::value::object();
-                    response["status"] = 200;
-                    response["message"] = json::value::string(err);
-                    response["data"] = json::value::string(out_url);
-                    message.reply(status_codes::OK, response);
+                    http_response reply(response.status_code());
+                    reply.set_body(body.get());
+                    for (const auto &header : response.headers())
+                    {
+                        //the body is forwarded whole, not in the owner's chunks
+                        if (header.first != header_names::transfer_encoding)
+                            reply.headers()[header.first] = header.second;
+                    }
+                    message.reply(reply);
                 }
-                else if (code == -2)
+                catch (const std::exception &e)
                 {
-                    std::lock_guard<std::mutex> lock(url_mtx_);
-                    dead_video_param_ = std::make_pair(input_url, auto_replay ? out_url : "");
-                    cv_.notify_one();
+                    bad_gateway(e);
                 }
             });
         }
         catch (const std::exception &e)
         {
-            spdlog::error("HttpServer::HandStart exception {}", e.what());
+            bad_gateway(e);
         }
     });
+    return true;
 }
 
-void HttpServer::HandStop(http_request message)
+void HttpServer::RestoreSession(const ClusterSession &session)
 {
-    io_service_.post([=] {
-        try
+    TransformOptions options = session.options;
+    options.reconnect = session.auto_replay;
+    {
+        std::lock_guard<std::mutex> lock(replay_mtx_);
+        if (session.auto_replay)
+            auto_replay_urls_.insert(session.input_url);
+        //an auto replay of the restored session starts it with the same options again
+        session_options_[session.input_url] = options;
+    }
+
+    std::string out_url = session.output_url;
+    transform_api_->start(session.input_url, out_url, options, [this, session](int code, const std::string out_url, const std::string &err) {
+        if ((code == -1 || code == -2) && session.auto_replay)
         {
-            auto result = uri::split_query(message.relative_uri().query());
-            auto iter = result.find("url");
-            if (iter == result.end())
-            {
-                auto response = json::value::object();
-                response["status"] = 404;
-                response["message"] = json::value::string("url not find");
-                message.reply(status_codes::NotFound, response);
-            }
+            io_service_.post(std::bind(&HttpServer::ReplayDeadStream, this, session.input_url, out_url, std::chrono::steady_clock::now()));
+        }
+    });
+}
 
-            std::string input_url = iter->second;
-            std::string erroStr;
-            transform_api_->stop(input_url, erroStr);
-            auto response = json::value::object();
-            if (erroStr.empty())
-            {
-                response["status"] = 200;
-                response["message"] = json::value::string("successful");
-            }
-            else
-            {
-                response["status"] = 20001;
-                response["message"] = json::value::string(erroStr);
-            }
-            message.reply(status_codes::OK, response);
+void HttpServer::ReleaseSession(const ClusterSession &session)
+{
+    {
+        std::lock_guard<std::mutex> lock(replay_mtx_);
+        auto_replay_urls_.erase(session.input_url);
+        session_options_.erase(session.input_url);
+    }
+    //runs on the cluster thread, the give back reuses the output url once this returns
+    auto stopped = std::make_shared<std::promise<void>>();
+    std::future<void> done = stopped->get_future();
+    transform_api_->stop(session.input_url, [stopped](const std::string &err) { stopped->set_value(); });
+    done.wait();
+}
+
+void HttpServer::LocalSessions(std::vector<ClusterSession> &sessions)
+{
+    std::vector<TransformSessionInfo> infos;
+    if (!transform_api_->sessions(infos))
+    {
+        spdlog::warn("HttpServer local session list incomplete, a worker did not answer");
+    }
+    std::lock_guard<std::mutex> lock(replay_mtx_);
+    for (auto &info : infos)
+    {
+        ClusterSession session;
+        session.input_url = info.input_url;
+        session.output_url = info.output_url;
+        session.auto_replay = auto_replay_urls_.find(info.input_url) != auto_replay_urls_.end();
+        auto iter = session_options_.find(info.input_url);
+        if (iter != session_options_.end())
+        {
+            session.options = iter->second;
         }
-        catch (const std::exception &e)
+        else
         {
-            spdlog::error("HttpServer::HandTest exception {}", e.what());
+            session.options.shm_name = info.shm_name;
+            session.options.dvr_minutes = info.dvr_minutes;
+            session.options.thin = info.thin;
         }
-    });
+        sessions.push_back(session);
+    }
 }
 
 void HttpServer::Base64Encode(const std::string &input, std::string &output)
@@ -350,37 +859,46 @@ void HttpServer::Base64Decode(const std::string &input, std::string &output)
     output = result.str();
 }
 
-void HttpServer::ClearDeadStream()
+void HttpServer::ReplayDeadStream(const std::string &input_url, const std::string &out_url, std::chrono::steady_clock::time_point died)
 {
-    while (!quit_.load())
-    {
-        std::unique_lock<std::mutex> lock(url_mtx_);
-        cv_.wait(lock, [=] { return !dead_video_param_.first.empty(); });
-        std::string error;
-        transform_api_->stop(dead_video_param_.first, error);
-        if (!dead_video_param_.second.empty())
+    //a timer on the io_service instead of a sleeping thread per replay
+    auto timer = std::make_shared<boost::asio::steady_timer>(io_service_, std::chrono::seconds(5));
+    timer->async_wait([this, timer, input_url, out_url, died](const boost::system::error_code &ec) {
+        if (ec || quit_.load())
         {
-            std::pair<std::string, std::string> temp = dead_video_param_;
-            Timer *t = new Timer;
-            t->setTimeout([&, temp, t] {
-                std::string out_url = temp.second;
-                transform_api_->start(temp.first, out_url, [&, temp](int code, const std::string out_url, const std::string &err) {
-                    if (code == -2)
-                    {
-                        std::lock_guard<std::mutex> lock(url_mtx_);
-                        dead_video_param_ = temp;
-                        cv_.notify_one();
-                    }
-                    else if (code == -1)
-                    {
-                        std::lock_guard<std::mutex> lock(url_mtx_);
-                        dead_video_param_ = temp;
-                        cv_.notify_one();
-                    }
-                });
-                delete t;
-            },5000);
+            return;
         }
-        dead_video_param_ = std::make_pair("", "");
-    }
+
+        TransformOptions options;
+        {
+            //stopped meanwhile, the replay is cancelled
+            std::lock_guard<std::mutex> lock(replay_mtx_);
+            if (auto_replay_urls_.find(input_url) == auto_replay_urls_.end())
+            {
+                return;
+            }
+            auto iter = session_options_.find(input_url);
+            if (iter != session_options_.end())
+            {
+                options = iter->second;
+            }
+        }
+        options.reconnect = true;
+
+        std::string replay_url = out_url;
+        transform_api_->start(input_url, replay_url, options, [this, input_url, out_url, died](int code, const std::string, const std::string &err) {
+            if (code == 0)
+            {
+                //died is when the session ended, the reconnect rounds before it are logged by the session as
+                //"no usable input left after"; compare the sum with "reconnected in place"
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - died);
+                spdlog::info("{} full restart took {} ms after the session ended", input_url, elapsed.count());
+            }
+            else if (code == -1 || code == -2)
+            {
+                //a session that ran again counts from its new end
+                io_service_.post(std::bind(&HttpServer::ReplayDeadStream, this, input_url, out_url, code == -2 ? std::chrono::steady_clock::now() : died));
+            }
+        });
+    });
 }
@@ -2,11 +2,17 @@
 #include <cpprest/http_listener.h>
 #include <boost/asio/io_service.hpp>
 #include <thread>
+#include <chrono>
+#include <set>
+#include "transform_stream_api.h"
 using namespace web;
 using namespace http;
 using namespace http::experimental::listener;
 
-class TransformStreamApi;
+class AdmissionControl;
+class Cluster;
+class ProcessMonitor;
+struct ClusterSession;
 class HttpServer
 {
 public:
@@ -16,15 +22,27 @@ public:
     pplx::task<void> Accept();
     pplx::task<void> Shutdown();
     void SetTransformApi(const std::shared_ptr<TransformStreamApi>& ptr);
+    void SetAdmissionControl(const std::shared_ptr<AdmissionControl> &ptr);
+    void SetCluster(const std::shared_ptr<Cluster> &ptr);
+    void SetProcessMonitor(const std::shared_ptr<ProcessMonitor> &ptr);
     static std::vector<std::string> StringSplit(const std::string &s, const std::string &delim);
 
 private:
     void OnRequest(http_request);
     void HandStart(http_request);
     void HandStop(http_request);
+    void HandCapacity(http_request);
+    void HandSessions(http_request);
+    void HandReplay(http_request);
+    void HandStats(http_request);
+    bool RouteToOwner(http_request message, const std::string &input_url);
+    void RestoreSession(const ClusterSession &session);
+    void ReleaseSession(const ClusterSession &session);
+    void LocalSessions(std::vector<ClusterSession> &sessions);
     void Base64Encode(const std::string & input, std::string &output);
     void Base64Decode(const std::string &input, std::string &output);
-    void ClearDeadStream();
+    //died is when the session ended, the full restart latency is logged against it
+    void ReplayDeadStream(const std::string &input_url, const std::string &out_url, std::chrono::steady_clock::time_point died);
 
     http_listener listener_;
     std::mutex hander_mtx_;
@@ -34,8 +52,11 @@ private:
     boost::asio::io_service::work io_work_;
     std::vector<std::thread> threads_vec_;
     std::shared_ptr<TransformStreamApi> transform_api_;
-    std::pair<std::string, std::string> dead_video_param_;
-    std::mutex url_mtx_;
-    std::condition_variable cv_;
+    std::shared_ptr<AdmissionControl> admission_;
+    std::shared_ptr<Cluster> cluster_;
+    std::shared_ptr<ProcessMonitor> monitor_;
+    std::mutex replay_mtx_;
+    std::set<std::string> auto_replay_urls_;
+    std::map<std::string, TransformOptions> session_options_;
     std::atomic_bool quit_;
 };
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/prctl.h>
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/sinks/daily_file_sink.h"
@@ -6,6 +9,17 @@
 #include "http_server.h"
 #include "factory.h"
 #include "transform_stream_impl.h"
+#include "admission_control.h"
+#include "cluster.h"
+#include "stall_watchdog.h"
+#include "memory_budget.h"
+#include "process_monitor.h"
+#include "worker_pool.h"
+#include "dvr_buffer.h"
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
 #define VERSION "V1.0"
 
 std::mutex mtx;
@@ -19,30 +33,104 @@ void handleUserInterrupt(int signal){
 }
 std::string g_config_file = "config.xml";
 std::string g_oformat;
+int g_shm_ring_mb = 8;
+std::string g_dvr_dir = "dvr";
+int g_dvr_max_mb = 512;
+int g_open_timeout_ms = 5000;
+int g_probe_timeout_ms = 5000;
+int g_read_timeout_ms = 3000;
+int g_write_timeout_ms = 5000;
+int g_gop_cache_mb = 8;
+int g_reconnect_attempts = 3;
+StallWatchdog g_stall_watchdog;
+MemoryBudget g_memory_budget;
 
-int main()
+int main(int argc, char *argv[])
 {
+    if (argc > 1)
+    {
+        g_config_file = argv[1];
+    }
+    //the supervisor starts each worker as: <config> --worker <fd> <slot>
+    bool worker_mode = argc > 4 && std::string(argv[2]) == "--worker";
+    if (worker_mode)
+    {
+        //Ctrl-C reaches the whole process group, a worker only ends when its supervisor closes the channel
+        signal(SIGINT, SIG_IGN);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+    }
     try{std::cout << SPDLOG_VERSION << std::endl;
         Poco::AutoPtr<Poco::Util::XMLConfiguration> configuration = new Poco::Util::XMLConfiguration;
         configuration->load(g_config_file);
 
         auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
 
-        auto file_sink = std::make_shared<spdlog::sinks::daily_file_sink_mt>("logs/daily.txt", configuration->getInt("log.file[@update_h]"), configuration->getInt("log.file[@update_m]"));
+        auto file_sink = std::make_shared<spdlog::sinks::daily_file_sink_mt>(worker_mode ? "logs/worker_" + std::string(argv[4]) + ".txt" : "logs/daily.txt", configuration->getInt("log.file[@update_h]"), configuration->getInt("log.file[@update_m]"));
         file_sink->set_level(spdlog::level::level_enum(SPDLOG_LEVEL_TRACE));
 
         spdlog::set_default_logger(std::shared_ptr<spdlog::logger>(new spdlog::logger("multi_sink", {console_sink, file_sink})));
         spdlog::set_level(spdlog::level::level_enum(SPDLOG_LEVEL_TRACE));
 
+        //process-wide FFmpeg state, set up once before any session
+        av_register_all();
+        avformat_network_init();
+        av_log_set_level(AV_LOG_INFO);
+
         Factory<TransformStreamApi, std::string> factory;
         factory.Register("ffmpeg", []() -> TransformStreamApi * { return new TransformStream; });
         
-        TransformStreamApi *handle = factory.CreateObject(configuration->getString("video_transform[@transoform_use]"));
+        //workers > 0 runs the sessions in that many child processes, this one only serves the api
+        int workers = worker_mode ? 0 : configuration->getInt("workers[@count]", 0);
+        TransformStreamApi *handle = workers > 0 ? new WorkerPool(workers, g_config_file) : factory.CreateObject(configuration->getString("video_transform[@transoform_use]"));
         handle->set_media_host(configuration->getString("video_transform[@media_server]"));
         g_oformat = configuration->getString("video_transform[@oformat]");
+        g_shm_ring_mb = configuration->getInt("video_transform[@shm_ring_mb]", 8);
+        g_dvr_dir = configuration->getString("video_transform[@dvr_dir]", "dvr");
+        g_dvr_max_mb = configuration->getInt("video_transform[@dvr_max_mb]", 512);
+        g_open_timeout_ms = configuration->getInt("video_transform[@open_timeout_ms]", 5000);
+        g_probe_timeout_ms = configuration->getInt("video_transform[@probe_timeout_ms]", 5000);
+        g_read_timeout_ms = configuration->getInt("video_transform[@read_timeout_ms]", 3000);
+        g_write_timeout_ms = configuration->getInt("video_transform[@write_timeout_ms]", 5000);
+        g_gop_cache_mb = configuration->getInt("video_transform[@gop_cache_mb]", 8);
+        g_reconnect_attempts = configuration->getInt("video_transform[@reconnect_attempts]", 3);
+        g_stall_watchdog.Start(configuration->getInt("video_transform[@watchdog_tick_ms]", 100));
+        mkdir(g_dvr_dir.c_str(), 0755);
+        DvrBuffer::Sweep(g_dvr_dir);
+
+        //the limit covers all workers, each one sheds its own caches against an equal share
+        int64_t memory_limit_mb = configuration->getInt("memory[@limit_mb]", 0);
+        std::string memory_shed = configuration->getString("memory[@shed]", "cache,admission");
+        int memory_shares = worker_mode ? std::max(1, configuration->getInt("workers[@count]", 1)) : 1;
+        g_memory_budget.Configure((memory_limit_mb << 20) / memory_shares, memory_shed.find("cache") != std::string::npos);
+
+        std::shared_ptr<TransformStreamApi> transform_api(handle);
+        if (worker_mode)
+        {
+            RunWorker(std::atoi(argv[3]), transform_api);
+            return 0;
+        }
+        AdmissionBudget budget;
+        budget.max_sessions = configuration->getInt("admission[@max_sessions]", 0);
+        budget.max_cpu = configuration->getDouble("admission[@max_cpu]", 0);
+        budget.max_input_kbps = configuration->getInt("admission[@max_input_kbps]", 0);
+        budget.max_rss_mb = configuration->getInt("admission[@max_rss_mb]", 0);
+        budget.max_memory_mb = memory_shed.find("admission") != std::string::npos ? memory_limit_mb : 0;
+        budget.retry_after = configuration->getInt("admission[@retry_after]", 5);
 
         HttpServer server("http://0.0.0.0:" + configuration->getString("http_server[@port]"), configuration->getInt("http_server[@threads]"));
-        server.SetTransformApi(std::shared_ptr<TransformStreamApi>(handle));
+        server.SetTransformApi(transform_api);
+        server.SetAdmissionControl(std::make_shared<AdmissionControl>(budget, transform_api));
+        server.SetProcessMonitor(std::make_shared<ProcessMonitor>(transform_api, configuration->getInt("monitor[@interval]", 10), configuration->getInt("monitor[@window]", 360)));
+        if (configuration->getBool("cluster[@enable]", false))
+        {
+            std::vector<std::string> nodes;
+            for (int i = 0; configuration->has("cluster.node[" + std::to_string(i) + "][@url]"); i++)
+            {
+                nodes.push_back(configuration->getString("cluster.node[" + std::to_string(i) + "][@url]"));
+            }
+            server.SetCluster(std::make_shared<Cluster>(configuration->getString("cluster[@self]"), nodes, configuration->getString("cluster[@mode]", "forward"),
+                                                        configuration->getInt("cluster[@replicas]", 160), configuration->getInt("cluster[@check_interval]", 2), configuration->getInt("cluster[@fail_threshold]", 3)));
+        }
         server.Accept().wait();
         spdlog::info("Video Transform Micro Server {} start listen on {}", VERSION, server.EndPoint());
 
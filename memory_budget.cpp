@@ -0,0 +1,91 @@
+#include "spdlog/spdlog.h"
+#include "memory_budget.h"
+
+void MemoryBudget::Configure(int64_t limit_bytes, bool shed_caches)
+{
+    limit_ = limit_bytes;
+    shed_caches_ = shed_caches;
+}
+
+void MemoryBudget::Add(int64_t bytes)
+{
+    int64_t used = used_.fetch_add(bytes) + bytes;
+    if (limit_ <= 0)
+    {
+        return;
+    }
+    //hysteresis, shedding a cache must not refill it right away
+    if (!over_.load() && used > limit_)
+    {
+        if (!over_.exchange(true))
+            spdlog::warn("MemoryBudget {} MB over the limit of {} MB, shedding", used >> 20, limit_ >> 20);
+    }
+    else if (over_.load() && used < limit_ / 10 * 9)
+    {
+        if (over_.exchange(false))
+            spdlog::info("MemoryBudget back to {} MB, shedding stopped", used >> 20);
+    }
+}
+
+int64_t MemoryBudget::Used() const
+{
+    return used_.load();
+}
+
+int64_t MemoryBudget::Limit() const
+{
+    return limit_;
+}
+
+bool MemoryBudget::Over() const
+{
+    return over_.load();
+}
+
+bool MemoryBudget::ShedCaches() const
+{
+    return shed_caches_ && over_.load();
+}
+
+MemoryAccount::MemoryAccount(MemoryBudget *budget) : budget_(budget)
+{
+    for (auto &used : used_)
+    {
+        used.store(0);
+    }
+}
+
+MemoryAccount::~MemoryAccount()
+{
+    budget_->Add(-Total());
+}
+
+void MemoryAccount::Add(MemoryKind kind, int64_t bytes)
+{
+    used_[kind].fetch_add(bytes);
+    budget_->Add(bytes);
+}
+
+void MemoryAccount::Set(MemoryKind kind, int64_t bytes)
+{
+    int64_t old = used_[kind].exchange(bytes);
+    if (bytes != old)
+    {
+        budget_->Add(bytes - old);
+    }
+}
+
+int64_t MemoryAccount::Used(MemoryKind kind) const
+{
+    return used_[kind].load();
+}
+
+int64_t MemoryAccount::Total() const
+{
+    int64_t total = 0;
+    for (auto &used : used_)
+    {
+        total += used.load();
+    }
+    return total;
+}
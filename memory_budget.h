@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+//memory the pipeline allocates itself, RSS as a whole can not be split per session
+enum MemoryKind
+{
+    kMemoryPacket = 0, //packet being remuxed
+    kMemoryAvio,       //AVIO buffers of the input and the output
+    kMemoryCache,      //standby GOP cache
+    kMemoryRing,       //shm packet ring, /dev/shm is RAM as well
+    kMemoryKinds
+};
+
+//Sum of every session's account against the configured limit. Over the limit the shedding that is
+//enabled kicks in until usage falls under 90% of it again.
+class MemoryBudget
+{
+public:
+    MemoryBudget() = default;
+    //limit 0 disables shedding, usage is still counted
+    void Configure(int64_t limit_bytes, bool shed_caches);
+    void Add(int64_t bytes);
+    int64_t Used() const;
+    int64_t Limit() const;
+    bool Over() const;
+    //caches are dropped and not refilled while over budget
+    bool ShedCaches() const;
+
+private:
+    std::atomic<int64_t> used_{0};
+    int64_t limit_ = 0;
+    bool shed_caches_ = false;
+    std::atomic_bool over_{false};
+};
+
+//one session's share, everything still charged is given back on destruction
+class MemoryAccount
+{
+public:
+    explicit MemoryAccount(MemoryBudget *budget);
+    ~MemoryAccount();
+    void Add(MemoryKind kind, int64_t bytes);
+    //for usage that is replaced rather than accumulated, like the packet in flight
+    void Set(MemoryKind kind, int64_t bytes);
+    int64_t Used(MemoryKind kind) const;
+    int64_t Total() const;
+
+private:
+    MemoryBudget *budget_;
+    std::atomic<int64_t> used_[kMemoryKinds];
+};
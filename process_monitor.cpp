@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <dirent.h>
+#include <unistd.h>
+#include "spdlog/spdlog.h"
+#include "process_monitor.h"
+#include "transform_stream_api.h"
+
+namespace
+{
+    int64_t NowSeconds()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int CountDirEntries(const char *path)
+    {
+        DIR *dir = opendir(path);
+        if (!dir)
+        {
+            return 0;
+        }
+        int count = 0;
+        while (struct dirent *entry = readdir(dir))
+        {
+            if (entry->d_name[0] != '.')
+                count++;
+        }
+        closedir(dir);
+        return count;
+    }
+
+    double Percentile(std::vector<int64_t> &values, double ratio)
+    {
+        if (values.empty())
+        {
+            return 0;
+        }
+        size_t nth = std::min(values.size() - 1, size_t(values.size() * ratio));
+        std::nth_element(values.begin(), values.begin() + nth, values.end());
+        return values[nth] / 1000.0;
+    }
+
+    //floor of the newest third against the floor of the oldest third, slack absorbs normal jitter
+    template <typename Get>
+    bool FloorRising(const std::deque<ProcessSample> &samples, Get get, double ratio, int64_t slack)
+    {
+        size_t third = samples.size() / 3;
+        int64_t old_floor = INT64_MAX, new_floor = INT64_MAX;
+        int old_sessions = 0, new_sessions = 0;
+        for (size_t i = 0; i < third; i++)
+        {
+            old_floor = std::min<int64_t>(old_floor, get(samples[i]));
+            old_sessions = std::max(old_sessions, samples[i].sessions);
+        }
+        for (size_t i = samples.size() - third; i < samples.size(); i++)
+        {
+            new_floor = std::min<int64_t>(new_floor, get(samples[i]));
+            new_sessions = std::max(new_sessions, samples[i].sessions);
+        }
+        return new_sessions <= old_sessions && new_floor > old_floor * (1 + ratio) + slack;
+    }
+} // namespace
+
+ProcessMonitor::ProcessMonitor(const std::shared_ptr<TransformStreamApi> &transform_api, int interval_s, int window)
+    : transform_api_(transform_api), interval_s_(std::max(1, interval_s)), window_(std::max(12, window)), start_s_(NowSeconds())
+{
+    thr_ = std::thread(&ProcessMonitor::Loop, this);
+}
+
+ProcessMonitor::~ProcessMonitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    thr_.join();
+}
+
+void ProcessMonitor::RecordLatency(const std::string &path, int64_t latency_us)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    LatencyWindow &latency = latencies_[path];
+    latency.count++;
+    latency.latest_us.push_back(latency_us);
+    if (latency.latest_us.size() > kLatencyWindow)
+    {
+        latency.latest_us.pop_front();
+    }
+}
+
+void ProcessMonitor::Samples(std::vector<ProcessSample> &samples)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    samples.assign(samples_.begin(), samples_.end());
+}
+
+void ProcessMonitor::Latencies(std::map<std::string, LatencyStats> &latencies)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto &item : latencies_)
+    {
+        std::vector<int64_t> values(item.second.latest_us.begin(), item.second.latest_us.end());
+        LatencyStats &stats = latencies[item.first];
+        stats.count = item.second.count;
+        stats.p50_ms = Percentile(values, 0.5);
+        stats.p99_ms = Percentile(values, 0.99);
+    }
+}
+
+ProcessGrowth ProcessMonitor::Growth()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return growth_;
+}
+
+void ProcessMonitor::Loop()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!quit_)
+    {
+        lock.unlock();
+        ProcessSample sample = Sample();
+        lock.lock();
+
+        if (sample.sessions >= 0)
+        {
+            samples_.push_back(sample);
+            if (samples_.size() > window_)
+            {
+                samples_.pop_front();
+            }
+            CheckGrowth();
+        }
+        cv_.wait_for(lock, std::chrono::seconds(interval_s_), [this] { return quit_; });
+    }
+}
+
+ProcessSample ProcessMonitor::Sample()
+{
+    ProcessSample sample;
+    sample.uptime_s = NowSeconds() - start_s_;
+
+    //workers do the media work in multi-process mode, a leak there counts as much as one here
+    std::vector<int> pids(1, getpid());
+    transform_api_->worker_pids(pids);
+    for (int pid : pids)
+    {
+        std::string proc = "/proc/" + std::to_string(pid);
+        std::ifstream statm(proc + "/statm");
+        int64_t size = 0, resident = 0;
+        statm >> size >> resident;
+        sample.rss_kb += resident * sysconf(_SC_PAGESIZE) / 1024;
+        sample.threads += CountDirEntries((proc + "/task").c_str());
+        sample.fds += CountDirEntries((proc + "/fd").c_str());
+    }
+    //minus the descriptor opendir itself holds while counting
+    sample.fds = std::max(0, sample.fds - 1);
+
+    std::vector<TransformSessionInfo> infos;
+    //-1 if a worker did not answer, the sample is not judged against a partial count
+    sample.sessions = transform_api_->sessions(infos) ? infos.size() : -1;
+    return sample;
+}
+
+void ProcessMonitor::CheckGrowth()
+{
+    //a third of the window has to be at least a few samples to say anything
+    if (samples_.size() < 12)
+    {
+        return;
+    }
+
+    ProcessGrowth growth;
+    growth.rss = FloorRising(samples_, [](const ProcessSample &s) { return s.rss_kb; }, 0.25, 16 * 1024);
+    growth.threads = FloorRising(samples_, [](const ProcessSample &s) { return s.threads; }, 0, 4);
+    growth.fds = FloorRising(samples_, [](const ProcessSample &s) { return s.fds; }, 0, 8);
+
+    const ProcessSample &last = samples_.back();
+    if (growth.rss && !growth_.rss)
+        spdlog::warn("ProcessMonitor rss keeps growing, now {} kB with {} sessions", last.rss_kb, last.sessions);
+    if (growth.threads && !growth_.threads)
+        spdlog::warn("ProcessMonitor thread count keeps growing, now {} with {} sessions", last.threads, last.sessions);
+    if (growth.fds && !growth_.fds)
+        spdlog::warn("ProcessMonitor fd count keeps growing, now {} with {} sessions", last.fds, last.sessions);
+    growth_ = growth;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <map>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <condition_variable>
+
+class TransformStreamApi;
+
+struct ProcessSample
+{
+    int64_t uptime_s = 0;
+    int64_t rss_kb = 0;
+    int threads = 0;
+    int fds = 0;
+    int sessions = 0;
+};
+
+struct LatencyStats
+{
+    int64_t count = 0; //requests since start, the percentiles cover the last kLatencyWindow
+    double p50_ms = 0;
+    double p99_ms = 0;
+};
+
+//a resource whose floor kept rising over the window while the session count did not
+struct ProcessGrowth
+{
+    bool rss = false;
+    bool threads = false;
+    bool fds = false;
+};
+
+//Samples RSS, thread and fd counts of the process and keeps API latencies, so start/stop churn can be
+//watched for leaks from outside while it runs. Growth is judged on the lowest values of the oldest and
+//newest third of the window: churn makes the values swing, a leak lifts the floor.
+class ProcessMonitor
+{
+public:
+    ProcessMonitor(const std::shared_ptr<TransformStreamApi> &transform_api, int interval_s, int window);
+    ~ProcessMonitor();
+    void RecordLatency(const std::string &path, int64_t latency_us);
+    void Samples(std::vector<ProcessSample> &samples);
+    void Latencies(std::map<std::string, LatencyStats> &latencies);
+    ProcessGrowth Growth();
+
+private:
+    struct LatencyWindow
+    {
+        int64_t count = 0;
+        std::deque<int64_t> latest_us;
+    };
+    static const size_t kLatencyWindow = 1024;
+
+    void Loop();
+    ProcessSample Sample();
+    void CheckGrowth();
+
+    std::shared_ptr<TransformStreamApi> transform_api_;
+    int interval_s_;
+    size_t window_;
+    int64_t start_s_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool quit_ = false;
+    std::deque<ProcessSample> samples_;
+    std::map<std::string, LatencyWindow> latencies_;
+    ProcessGrowth growth_;
+    std::thread thr_;
+};
@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_packet_ring.h"
+
+namespace
+{
+    inline uint64_t Align8(uint64_t n)
+    {
+        return (n + 7) & ~uint64_t(7);
+    }
+
+    //data area starts on its own page so the header and hot packet data do not share cache lines
+    inline size_t HeaderSize()
+    {
+        return (sizeof(ShmRingHeader) + 4095) & ~size_t(4095);
+    }
+
+    int OpenFile(const std::string &path, int flags, bool &is_shm)
+    {
+        is_shm = path.find('/') == std::string::npos;
+        if (is_shm)
+        {
+            return shm_open(("/" + path).c_str(), flags, 0644);
+        }
+        return open(path.c_str(), flags, 0644);
+    }
+
+    void RemoveFile(const std::string &path, bool is_shm)
+    {
+        if (is_shm)
+            shm_unlink(("/" + path).c_str());
+        else
+            unlink(path.c_str());
+    }
+
+    //only a ring whose writer said it is done or whose writer process is gone may be replaced; one
+    //without a pid or magic yet is being created by a racing writer and counts as in use
+    bool Abandoned(const std::string &path)
+    {
+        bool is_shm;
+        int fd = OpenFile(path, O_RDONLY, is_shm);
+        if (fd < 0)
+        {
+            return errno == ENOENT;
+        }
+        struct stat st;
+        bool abandoned = false;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(ShmRingHeader))
+        {
+            void *addr = mmap(NULL, sizeof(ShmRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                const ShmRingHeader *header = static_cast<const ShmRingHeader *>(addr);
+                pid_t writer_pid = header->writer_pid;
+                abandoned = header->closed.load() || (writer_pid > 0 && kill(writer_pid, 0) != 0 && errno == ESRCH);
+                munmap(addr, sizeof(ShmRingHeader));
+            }
+        }
+        close(fd);
+        return abandoned;
+    }
+} // namespace
+
+ShmPacketWriter::~ShmPacketWriter()
+{
+    Close();
+}
+
+bool ShmPacketWriter::Create(const std::string &path, uint64_t capacity, std::string &err)
+{
+    capacity &= ~uint64_t(7);
+    if (capacity < 4096)
+    {
+        err = "ring capacity too small";
+        return false;
+    }
+
+    //never truncate a ring somebody still writes, its readers would fault and both writers would mix
+    int fd = OpenFile(path, O_CREAT | O_EXCL | O_RDWR, is_shm_);
+    if (fd < 0 && errno == EEXIST && Abandoned(path))
+    {
+        RemoveFile(path, is_shm_);
+        fd = OpenFile(path, O_CREAT | O_EXCL | O_RDWR, is_shm_);
+    }
+    if (fd < 0)
+    {
+        err = "open " + path + " failed: " + (errno == EEXIST ? "in use by another writer" : strerror(errno));
+        return false;
+    }
+    map_size_ = HeaderSize() + capacity;
+    if (ftruncate(fd, map_size_) != 0)
+    {
+        err = "ftruncate " + path + " failed: " + strerror(errno);
+        close(fd);
+        RemoveFile(path, is_shm_);
+        return false;
+    }
+    void *addr = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        err = "mmap " + path + " failed: " + strerror(errno);
+        RemoveFile(path, is_shm_);
+        return false;
+    }
+
+    path_ = path;
+    header_ = static_cast<ShmRingHeader *>(addr);
+    data_ = static_cast<uint8_t *>(addr) + HeaderSize();
+    header_->version = kShmRingVersion;
+    header_->capacity = capacity;
+    header_->reserve_pos.store(0, std::memory_order_relaxed);
+    header_->write_pos.store(0, std::memory_order_relaxed);
+    header_->params_seq.store(0, std::memory_order_relaxed);
+    header_->closed.store(0, std::memory_order_relaxed);
+    header_->nb_streams = 0;
+    header_->writer_pid = getpid();
+    //readers refuse the mapping until the magic is there
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = kShmRingMagic;
+    return true;
+}
+
+void ShmPacketWriter::SetParams(const ShmStreamParams *streams, int nb_streams)
+{
+    if (nb_streams > kShmMaxStreams)
+    {
+        nb_streams = kShmMaxStreams;
+    }
+    uint32_t seq = header_->params_seq.load(std::memory_order_relaxed);
+    header_->params_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header_->streams, streams, sizeof(ShmStreamParams) * nb_streams);
+    header_->nb_streams = nb_streams;
+    header_->params_seq.store(seq + 2, std::memory_order_release);
+}
+
+bool ShmPacketWriter::Write(const ShmPacketHeader &pkt, const uint8_t *data)
+{
+    const uint64_t capacity = header_->capacity;
+    uint64_t len = Align8(sizeof(ShmPacketHeader) + pkt.size);
+    if (len > capacity / 4)
+    {
+        return false;
+    }
+
+    uint64_t pos = header_->write_pos.load(std::memory_order_relaxed);
+    uint64_t offset = pos % capacity;
+    uint64_t padding = offset + len > capacity ? capacity - offset : 0;
+    //readers check reserve_pos after touching a record, it has to move before the bytes do
+    header_->reserve_pos.store(pos + padding + len, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (padding)
+    {
+        if (padding >= sizeof(ShmPacketHeader))
+        {
+            ShmPacketHeader pad;
+            memset(&pad, 0, sizeof(pad));
+            pad.size = kShmPadding;
+            pad.pos = pos;
+            memcpy(data_ + offset, &pad, sizeof(pad));
+        }
+        pos += padding;
+        offset = 0;
+    }
+
+    ShmPacketHeader header = pkt;
+    header.pos = pos;
+    memcpy(data_ + offset, &header, sizeof(header));
+    memcpy(data_ + offset + sizeof(header), data, pkt.size);
+    header_->write_pos.store(pos + len, std::memory_order_release);
+    return true;
+}
+
+void ShmPacketWriter::Close()
+{
+    if (!header_)
+    {
+        return;
+    }
+    header_->closed.store(1, std::memory_order_release);
+    munmap(header_, map_size_);
+    //readers that already mapped the ring keep it alive and see closed, new ones can not open it
+    if (is_shm_)
+    {
+        shm_unlink(("/" + path_).c_str());
+    }
+    header_ = nullptr;
+    data_ = nullptr;
+}
+
+const std::string &ShmPacketWriter::Path() const
+{
+    return path_;
+}
+
+uint64_t ShmPacketWriter::WritePos() const
+{
+    return header_->write_pos.load(std::memory_order_relaxed);
+}
+
+uint64_t ShmPacketWriter::Capacity() const
+{
+    return header_->capacity;
+}
+
+ShmPacketReader::~ShmPacketReader()
+{
+    Close();
+}
+
+bool ShmPacketReader::Open(const std::string &path, std::string &err)
+{
+    int fd = OpenFile(path, O_RDONLY, is_shm_);
+    if (fd < 0)
+    {
+        err = "open " + path + " failed: " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < HeaderSize())
+    {
+        err = path + " is not a packet ring";
+        close(fd);
+        return false;
+    }
+    map_size_ = st.st_size;
+    void *addr = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        err = "mmap " + path + " failed: " + strerror(errno);
+        return false;
+    }
+
+    header_ = static_cast<const ShmRingHeader *>(addr);
+    data_ = static_cast<const uint8_t *>(addr) + HeaderSize();
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->magic != kShmRingMagic || header_->version != kShmRingVersion || HeaderSize() + header_->capacity > map_size_)
+    {
+        err = path + " is not a packet ring or has another version";
+        Close();
+        return false;
+    }
+    //join at the live edge, callers wait for a key frame
+    read_pos_ = header_->write_pos.load(std::memory_order_acquire);
+    return true;
+}
+
+int ShmPacketReader::Params(ShmStreamParams *streams, int max_streams)
+{
+    while (true)
+    {
+        uint32_t seq = header_->params_seq.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            continue;
+        }
+        int nb_streams = std::min<int>(header_->nb_streams, std::min(max_streams, kShmMaxStreams));
+        memcpy(streams, header_->streams, sizeof(ShmStreamParams) * nb_streams);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header_->params_seq.load(std::memory_order_relaxed) == seq)
+        {
+            return nb_streams;
+        }
+    }
+}
+
+ShmPacketReader::Result ShmPacketReader::Next(ShmPacketView &view)
+{
+    const uint64_t capacity = header_->capacity;
+    while (true)
+    {
+        uint64_t write_pos = header_->write_pos.load(std::memory_order_acquire);
+        if (read_pos_ == write_pos)
+        {
+            return header_->closed.load(std::memory_order_acquire) ? kClosed : kEmpty;
+        }
+        if (write_pos - read_pos_ > capacity)
+        {
+            read_pos_ = write_pos;
+            lapped_++;
+            return kLapped;
+        }
+
+        uint64_t offset = read_pos_ % capacity;
+        if (capacity - offset < sizeof(ShmPacketHeader))
+        {
+            read_pos_ += capacity - offset;
+            continue;
+        }
+        memcpy(&view.header, data_ + offset, sizeof(view.header));
+        view.data = data_ + offset + sizeof(view.header);
+        if (view.header.pos != read_pos_ || !Valid(view))
+        {
+            read_pos_ = header_->write_pos.load(std::memory_order_acquire);
+            lapped_++;
+            return kLapped;
+        }
+        if (view.header.size == kShmPadding)
+        {
+            read_pos_ += capacity - offset;
+            continue;
+        }
+        read_pos_ += Align8(sizeof(view.header) + view.header.size);
+        return kPacket;
+    }
+}
+
+bool ShmPacketReader::Valid(const ShmPacketView &view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header_->reserve_pos.load(std::memory_order_relaxed) - view.header.pos <= header_->capacity;
+}
+
+void ShmPacketReader::Seek(uint64_t pos)
+{
+    read_pos_ = pos;
+}
+
+uint64_t ShmPacketReader::ReadPos() const
+{
+    return read_pos_;
+}
+
+uint64_t ShmPacketReader::Lapped() const
+{
+    return lapped_;
+}
+
+void ShmPacketReader::Close()
+{
+    if (header_)
+    {
+        munmap(const_cast<ShmRingHeader *>(header_), map_size_);
+        header_ = nullptr;
+        data_ = nullptr;
+    }
+}
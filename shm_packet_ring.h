@@ -0,0 +1,130 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+//Packet ring in a memory-mapped file, one writer and any number of lock-free readers.
+//Records are [ShmPacketHeader | payload] aligned to 8 bytes and never wrap, the tail of the data
+//area is skipped with a padding record instead. write_pos/reserve_pos only grow, a reader owns its
+//read position and checks reserve_pos after touching a record to detect that the writer lapped it.
+//The header has no FFmpeg types so co-located consumers only need this file and shm_packet_ring.cpp.
+
+static const uint32_t kShmRingMagic = 0x56545352; //"VTSR"
+static const uint32_t kShmRingVersion = 1;
+static const int kShmMaxStreams = 8;
+static const int kShmMaxExtradata = 4096;
+
+struct ShmStreamParams
+{
+    int32_t codec_type; //AVMediaType
+    int32_t codec_id;   //AVCodecID
+    uint32_t codec_tag;
+    int32_t format;
+    int64_t bit_rate;
+    int32_t profile;
+    int32_t level;
+    int32_t width;
+    int32_t height;
+    int32_t sample_aspect_num;
+    int32_t sample_aspect_den;
+    int32_t channels;
+    int32_t sample_rate;
+    uint64_t channel_layout;
+    int32_t frame_size;
+    int32_t time_base_num; //timestamps of this stream's packets are in this time base
+    int32_t time_base_den;
+    uint32_t extradata_size;
+    uint8_t extradata[kShmMaxExtradata];
+};
+
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity; //bytes of the data area following the header
+    std::atomic<uint64_t> reserve_pos; //end of the record being written
+    std::atomic<uint64_t> write_pos;   //end of the last complete record
+    std::atomic<uint32_t> params_seq;  //odd while params are being updated
+    std::atomic<uint32_t> closed;
+    uint32_t nb_streams;
+    uint32_t writer_pid; //a ring whose writer is gone may be taken over by a new one
+    ShmStreamParams streams[kShmMaxStreams];
+};
+
+struct ShmPacketHeader
+{
+    uint32_t size; //payload bytes, kShmPadding skips to the start of the data area
+    int32_t stream_index;
+    int32_t flags; //AV_PKT_FLAG_*
+    uint32_t reserved;
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+    uint64_t pos; //ring position of this record, guards against reading garbage after a lap
+};
+
+static const uint32_t kShmPadding = 0xffffffff;
+
+class ShmPacketWriter
+{
+public:
+    ShmPacketWriter() = default;
+    ~ShmPacketWriter();
+    //path is a name in /dev/shm when it has no '/', a regular file otherwise; fails if a live writer
+    //already has it, a ring left behind by a crashed one is replaced
+    bool Create(const std::string &path, uint64_t capacity, std::string &err);
+    void SetParams(const ShmStreamParams *streams, int nb_streams);
+    //packets bigger than a quarter of the ring are dropped, they would evict every reader
+    bool Write(const ShmPacketHeader &pkt, const uint8_t *data);
+    void Close();
+    const std::string &Path() const;
+    uint64_t WritePos() const;
+    uint64_t Capacity() const;
+
+private:
+    std::string path_;
+    bool is_shm_ = false;
+    size_t map_size_ = 0;
+    ShmRingHeader *header_ = nullptr;
+    uint8_t *data_ = nullptr;
+};
+
+struct ShmPacketView
+{
+    ShmPacketHeader header;
+    const uint8_t *data; //points into the mapping, valid until ShmPacketReader::Valid says otherwise
+};
+
+class ShmPacketReader
+{
+public:
+    enum Result
+    {
+        kPacket = 0,
+        kEmpty,  //nothing new, poll again later
+        kLapped, //reader was too slow, skipped ahead to the live edge
+        kClosed  //writer is gone
+    };
+
+    ShmPacketReader() = default;
+    ~ShmPacketReader();
+    bool Open(const std::string &path, std::string &err);
+    //consistent snapshot of the stream parameters
+    int Params(ShmStreamParams *streams, int max_streams);
+    Result Next(ShmPacketView &view);
+    //call after consuming view.data, false means the payload was overwritten meanwhile
+    bool Valid(const ShmPacketView &view) const;
+    //start reading from ring position pos, used to seek back inside the ring
+    void Seek(uint64_t pos);
+    uint64_t ReadPos() const;
+    uint64_t Lapped() const;
+    void Close();
+
+private:
+    bool is_shm_ = false;
+    size_t map_size_ = 0;
+    const ShmRingHeader *header_ = nullptr;
+    const uint8_t *data_ = nullptr;
+    uint64_t read_pos_ = 0;
+    uint64_t lapped_ = 0;
+};
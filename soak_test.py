@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+# Churn soak test against a running video_transform_micro_server.
+# Drives randomized transform_stream / stop / auto-replay cycles over the given sources, then drains
+# every session and compares fresh /rest/api/v1/stats samples taken idle before and after the churn,
+# and the api latency p99 after the warmup with the one at the end.
+# A file source reopens in place at its end, so auto-replay never needs a full restart there;
+# --flaky-source serves a file over a loopback tcp stream that is killed and brought back, long enough
+# down that reconnecting in place gives up and auto-replay restarts the session.
+# Exit code 0 passes, 1 means growth over a threshold or a leak flagged by the server, 2 a setup error.
+#
+#   ./soak_test.py --server http://127.0.0.1:6605 --source /data/test.mp4 \
+#       --flaky-source /data/test.mp4 --cycles 5000
+import argparse
+import json
+import random
+import shutil
+import subprocess
+import sys
+import threading
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+
+
+class Server:
+    def __init__(self, base, timeout):
+        self.base = base.rstrip("/")
+        self.timeout = timeout
+
+    def get(self, path, **params):
+        url = self.base + path
+        if params:
+            url += "?" + urllib.parse.urlencode(params)
+        try:
+            with urllib.request.urlopen(url, timeout=self.timeout) as resp:
+                return resp.status, json.loads(resp.read().decode() or "{}")
+        except urllib.error.HTTPError as e:
+            body = e.read().decode(errors="replace")
+            try:
+                return e.code, json.loads(body)
+            except ValueError:
+                return e.code, {"message": body}
+
+    def stats(self):
+        code, body = self.get("/rest/api/v1/stats")
+        if code != 200 or body.get("status") != 200:
+            raise RuntimeError("stats failed: %s %s" % (code, body))
+        return body["data"]
+
+    def sessions(self):
+        code, body = self.get("/rest/api/v1/sessions")
+        if code != 200:
+            raise RuntimeError("sessions failed: %s %s" % (code, body))
+        return body.get("data", [])
+
+
+class FlakySource:
+    """A loopback mpegts stream that goes away and comes back until stopped."""
+
+    def __init__(self, path, port, up_s, down_s, seed):
+        self.path = path
+        self.url = "tcp://127.0.0.1:%d" % port
+        self.up_s = up_s
+        self.down_s = down_s
+        self.rng = random.Random(seed)
+        self.outages = 0
+        self.quit = threading.Event()
+        self.thread = threading.Thread(target=self.loop)
+
+    def start(self):
+        self.thread.start()
+
+    def stop(self):
+        self.quit.set()
+        self.thread.join()
+
+    def loop(self):
+        while not self.quit.is_set():
+            # ffmpeg serves one client and exits when it leaves, it is started again while up
+            up_until = time.time() + self.rng.uniform(*self.up_s)
+            while not self.quit.is_set() and time.time() < up_until:
+                proc = subprocess.Popen(["ffmpeg", "-hide_banner", "-loglevel", "error", "-re", "-stream_loop", "-1",
+                                         "-i", self.path, "-c", "copy", "-f", "mpegts", "-listen", "1", self.url],
+                                        stdin=subprocess.DEVNULL)
+                while proc.poll() is None and not self.quit.is_set() and time.time() < up_until:
+                    time.sleep(0.1)
+                if proc.poll() is None:
+                    proc.kill()
+                proc.wait()
+            if self.quit.is_set():
+                return
+            self.outages += 1
+            self.quit.wait(self.rng.uniform(*self.down_s))
+
+
+def latency_p99(stats):
+    return {path: latency["p99_ms"] for path, latency in stats.get("latency", {}).items() if latency["count"] > 0}
+
+
+def fresh_idle_sample(server, sources, wait_s):
+    # the monitor samples on its own interval, wait for one taken after every session is gone;
+    # an auto-replay restart may still be in flight, it is stopped again
+    deadline = time.time() + wait_s
+    last_uptime = None
+    while time.time() < deadline:
+        if server.sessions():
+            drain(server, sources)
+            last_uptime = None
+            time.sleep(1)
+            continue
+        samples = server.stats()["samples"]
+        if samples:
+            sample = samples[-1]
+            if last_uptime is None:
+                last_uptime = sample["uptime"]
+            elif sample["uptime"] > last_uptime and sample["sessions"] == 0:
+                return sample
+        time.sleep(1)
+    raise RuntimeError("no idle stats sample within %d s, sessions left: %d" % (wait_s, len(server.sessions())))
+
+
+def drain(server, sources):
+    for source in sources:
+        server.get("/rest/api/v1/stop", url=source)
+
+
+class Churn:
+    def __init__(self, server, sources, seed):
+        self.server = server
+        self.sources = sources
+        self.rng = random.Random(seed)
+        self.lock = threading.Lock()
+        self.counts = {}
+        self.errors = []
+
+    def count(self, key):
+        with self.lock:
+            self.counts[key] = self.counts.get(key, 0) + 1
+
+    def cycle(self):
+        with self.lock:
+            source = self.rng.choice(self.sources)
+            action = self.rng.choice(["start", "start", "start_auto", "stop", "stop_auto"])
+            hold = self.rng.uniform(0, 2)
+        try:
+            if action in ("start", "start_auto"):
+                params = {"url": source}
+                if action == "start_auto":
+                    params["auto-replay"] = "true"
+                code, body = self.server.get("/rest/api/v1/transform_stream", **params)
+            else:
+                params = {"url": source}
+                if action == "stop_auto":
+                    params["auto-replay"] = "true"
+                code, body = self.server.get("/rest/api/v1/stop", **params)
+        except Exception as e:
+            # a hung or crashed server is a failure, not noise
+            self.count("exception")
+            with self.lock:
+                self.errors.append("%s %s: %s" % (action, source, e))
+            return
+        # 503 is admission doing its job, anything else 5xx is a failure
+        self.count("%s_%d" % (action, code))
+        if code >= 500 and code != 503:
+            with self.lock:
+                self.errors.append("%s %s: %d %s" % (action, source, code, body))
+        time.sleep(hold)
+
+    def run(self, cycles, concurrency):
+        remaining = [cycles]
+
+        def worker():
+            while True:
+                with self.lock:
+                    if remaining[0] <= 0:
+                        return
+                    remaining[0] -= 1
+                    done = cycles - remaining[0]
+                if done % 500 == 0:
+                    print("  %d/%d cycles" % (done, cycles), flush=True)
+                self.cycle()
+
+        threads = [threading.Thread(target=worker) for _ in range(concurrency)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="start/stop/auto-replay churn soak test")
+    parser.add_argument("--server", default="http://127.0.0.1:6605")
+    parser.add_argument("--source", action="append", default=[], help="file path or loopback stream url, repeatable")
+    parser.add_argument("--flaky-source", help="file served on --flaky-port and killed now and then, forces full restarts")
+    parser.add_argument("--flaky-port", type=int, default=18554)
+    parser.add_argument("--flaky-up", type=float, nargs=2, default=[2, 10], metavar=("MIN", "MAX"), help="seconds the flaky source stays up")
+    parser.add_argument("--flaky-down", type=float, nargs=2, default=[20, 30], metavar=("MIN", "MAX"),
+                        help="seconds it stays down, longer than the reconnect rounds with their open timeouts")
+    parser.add_argument("--cycles", type=int, default=2000)
+    parser.add_argument("--warmup", type=int, default=200, help="cycles before the baseline is taken")
+    parser.add_argument("--concurrency", type=int, default=8)
+    parser.add_argument("--seed", type=int, default=int(time.time()))
+    parser.add_argument("--timeout", type=float, default=30, help="seconds per api call, a start waits for the first frame")
+    parser.add_argument("--settle", type=int, default=60, help="seconds to wait for an idle stats sample")
+    parser.add_argument("--max-rss-growth-mb", type=float, default=32)
+    parser.add_argument("--max-thread-growth", type=int, default=4)
+    parser.add_argument("--max-fd-growth", type=int, default=8)
+    parser.add_argument("--max-errors", type=int, default=0, help="5xx other than 503 and failed calls allowed")
+    parser.add_argument("--max-p99-growth", type=float, default=2.0, help="end p99 over baseline p99, per api path")
+    parser.add_argument("--p99-slack-ms", type=float, default=50, help="added to the allowed p99, small values are noisy")
+    args = parser.parse_args()
+
+    sources = list(args.source)
+    flaky = None
+    if args.flaky_source:
+        if not shutil.which("ffmpeg"):
+            print("setup error: --flaky-source needs ffmpeg in PATH")
+            return 2
+        flaky = FlakySource(args.flaky_source, args.flaky_port, args.flaky_up, args.flaky_down, args.seed)
+        sources.append(flaky.url)
+    if not sources:
+        print("setup error: give --source or --flaky-source")
+        return 2
+
+    server = Server(args.server, args.timeout)
+    print("seed %d, %d sources, %d cycles" % (args.seed, len(sources), args.cycles))
+    try:
+        server.stats()
+        if flaky:
+            flaky.start()
+        churn = Churn(server, sources, args.seed)
+        # the first sessions load codecs and grow pools, that is not a leak
+        churn.run(args.warmup, args.concurrency)
+        drain(server, sources)
+        before = fresh_idle_sample(server, sources, args.settle)
+        before_p99 = latency_p99(server.stats())
+        print("baseline rss %d kB, %d threads, %d fds" % (before["rss_kb"], before["threads"], before["fds"]))
+
+        churn.run(args.cycles, args.concurrency)
+        drain(server, sources)
+        after = fresh_idle_sample(server, sources, args.settle)
+        stats = server.stats()
+    except Exception as e:
+        print("setup error: %s" % e)
+        return 2
+    finally:
+        if flaky:
+            flaky.stop()
+
+    print("after    rss %d kB, %d threads, %d fds" % (after["rss_kb"], after["threads"], after["fds"]))
+    print("calls %s" % json.dumps(churn.counts, sort_keys=True))
+    if flaky:
+        print("flaky source went down %d times" % flaky.outages)
+    for path, latency in sorted(stats.get("latency", {}).items()):
+        print("latency %s count %d p50 %.1f ms p99 %.1f ms (baseline p99 %.1f ms)" %
+              (path, latency["count"], latency["p50_ms"], latency["p99_ms"], before_p99.get(path, 0)))
+
+    failures = []
+    rss_growth_mb = (after["rss_kb"] - before["rss_kb"]) / 1024.0
+    if rss_growth_mb > args.max_rss_growth_mb:
+        failures.append("rss grew %.1f MB > %.1f MB" % (rss_growth_mb, args.max_rss_growth_mb))
+    if after["threads"] - before["threads"] > args.max_thread_growth:
+        failures.append("threads grew %d > %d" % (after["threads"] - before["threads"], args.max_thread_growth))
+    if after["fds"] - before["fds"] > args.max_fd_growth:
+        failures.append("fds grew %d > %d" % (after["fds"] - before["fds"], args.max_fd_growth))
+    if stats.get("leak_suspected"):
+        failures.append("server reports leak_suspected %s" % json.dumps(stats.get("growing")))
+    # the server keeps the latest requests per path, the end window is compared with the warmup one
+    for path, p99 in sorted(latency_p99(stats).items()):
+        if path in before_p99 and p99 > before_p99[path] * args.max_p99_growth + args.p99_slack_ms:
+            failures.append("%s p99 grew %.1f ms -> %.1f ms" % (path, before_p99[path], p99))
+    if len(churn.errors) > args.max_errors:
+        failures.append("%d failed calls > %d, first: %s" % (len(churn.errors), args.max_errors, churn.errors[0]))
+
+    for failure in failures:
+        print("FAIL " + failure)
+    if failures:
+        return 1
+    print("PASS")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
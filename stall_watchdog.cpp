@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+extern "C"
+{
+#include <libavutil/time.h>
+#include <libavutil/error.h>
+}
+#include "stall_watchdog.h"
+
+StallWatchdog::~StallWatchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    if (thr_.joinable())
+    {
+        thr_.join();
+    }
+}
+
+void StallWatchdog::Start(int tick_ms)
+{
+    tick_ms_ = std::max(10, tick_ms);
+    thr_ = std::thread(&StallWatchdog::Loop, this);
+}
+
+void StallWatchdog::Add(Deadline *deadline)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    deadlines_.insert(deadline);
+}
+
+void StallWatchdog::Remove(Deadline *deadline)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    deadlines_.erase(deadline);
+}
+
+void StallWatchdog::Arm(Deadline *deadline, const char *phase, int timeout_ms)
+{
+    deadline->phase.store(phase);
+    deadline->expire_us.store(av_gettime_relative() + int64_t(timeout_ms) * 1000);
+}
+
+void StallWatchdog::Disarm(Deadline *deadline)
+{
+    deadline->expire_us.store(0);
+}
+
+bool StallWatchdog::Expired(const Deadline *deadline)
+{
+    return deadline->expire_us.load() == kExpired;
+}
+
+extern StallWatchdog g_stall_watchdog;
+OutputGuard::OutputGuard(const std::atomic_bool *running, const std::string &name) : running_(running)
+{
+    deadline_.name = name;
+    g_stall_watchdog.Add(&deadline_);
+}
+
+OutputGuard::~OutputGuard()
+{
+    g_stall_watchdog.Remove(&deadline_);
+}
+
+void OutputGuard::Arm(const char *phase, int timeout_ms)
+{
+    StallWatchdog::Arm(&deadline_, phase, timeout_ms);
+}
+
+int OutputGuard::Done(int ret)
+{
+    if (ret < 0 && StallWatchdog::Expired(&deadline_))
+    {
+        ret = AVERROR(ETIMEDOUT);
+    }
+    StallWatchdog::Disarm(&deadline_);
+    return ret;
+}
+
+int OutputGuard::Callback(void *opaque)
+{
+    OutputGuard *self = static_cast<OutputGuard *>(opaque);
+    return !self->running_->load() || StallWatchdog::Expired(&self->deadline_);
+}
+
+void StallWatchdog::Loop()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!quit_)
+    {
+        cv_.wait_for(lock, std::chrono::milliseconds(tick_ms_));
+        int64_t now = av_gettime_relative();
+        for (Deadline *deadline : deadlines_)
+        {
+            //re-armed meanwhile if the exchange fails, the new deadline is checked next tick
+            int64_t expire = deadline->expire_us.load();
+            if (expire > 0 && now > expire && deadline->expire_us.compare_exchange_strong(expire, kExpired))
+            {
+                spdlog::warn("{} stalled in {}, aborted", deadline->name, deadline->phase.load());
+            }
+        }
+    }
+}
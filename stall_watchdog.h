@@ -0,0 +1,60 @@
+#pragma once
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+
+//One thread checks the deadline of every blocking open, probe and read. FFmpeg's interrupt callbacks
+//only load an atomic, so a stall is noticed within one tick without a timer per session.
+class StallWatchdog
+{
+public:
+    struct Deadline
+    {
+        std::atomic<int64_t> expire_us{0}; //av_gettime_relative() based, 0 disarmed, kExpired once passed
+        std::atomic<const char *> phase{""};
+        std::string name;
+    };
+    static const int64_t kExpired = -1;
+
+    StallWatchdog() = default;
+    ~StallWatchdog();
+    void Start(int tick_ms);
+    void Add(Deadline *deadline);
+    void Remove(Deadline *deadline);
+    static void Arm(Deadline *deadline, const char *phase, int timeout_ms);
+    static void Disarm(Deadline *deadline);
+    static bool Expired(const Deadline *deadline);
+
+private:
+    void Loop();
+
+    int tick_ms_ = 100;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::set<Deadline *> deadlines_;
+    bool quit_ = false;
+    std::thread thr_;
+};
+
+//Interrupt callback of a muxer and its AVIOContext. Without it a blocked publish (avio_open, the
+//header, a frame, the trailer) ignores stop and hangs for as long as the peer keeps the socket open.
+class OutputGuard
+{
+public:
+    //running is the owner's flag, clearing it aborts the blocked call at once
+    OutputGuard(const std::atomic_bool *running, const std::string &name);
+    ~OutputGuard();
+    void Arm(const char *phase, int timeout_ms);
+    //disarms, ret becomes AVERROR(ETIMEDOUT) if the deadline fired
+    int Done(int ret);
+    //for AVIOInterruptCB, opaque is the OutputGuard
+    static int Callback(void *opaque);
+
+private:
+    const std::atomic_bool *running_;
+    StallWatchdog::Deadline deadline_;
+};
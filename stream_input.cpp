@@ -0,0 +1,269 @@
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+extern "C"
+{
+#include <libavutil/time.h>
+#include <libavformat/avformat.h>
+}
+#include "stream_input.h"
+
+extern int g_open_timeout_ms;
+extern int g_probe_timeout_ms;
+extern int g_read_timeout_ms;
+extern int g_gop_cache_mb;
+extern StallWatchdog g_stall_watchdog;
+extern MemoryBudget g_memory_budget;
+
+StreamInput::StreamInput(const std::string &url, const std::atomic_bool *running, MemoryAccount *memory) : url_(url), running_(running), memory_(memory)
+{
+	deadline_.name = url;
+	g_stall_watchdog.Add(&deadline_);
+}
+
+StreamInput::~StreamInput()
+{
+	Interrupt();
+	StopStandby();
+	ClearCache();
+	if (format_ctx_)
+	{
+		avformat_close_input(&format_ctx_);
+	}
+	Charge(kMemoryAvio, -avio_bytes_);
+	g_stall_watchdog.Remove(&deadline_);
+}
+
+int StreamInput::Open(std::string &err)
+{
+	AVDictionary *opt = nullptr;
+	//av_dict_set(&opt,"buffer_size","1024000",0);
+	//av_dict_set(&opt,"max_delay","0",0);
+	av_dict_set(&opt, "rtsp_transport", "tcp", 0);
+	av_dict_set(&opt, "stimeout", "10000000", 0);
+
+	spdlog::trace("create {} AVFormatContext", url_);
+	format_ctx_ = avformat_alloc_context();
+	format_ctx_->interrupt_callback.callback = &StreamInput::InterruptCallback;
+	format_ctx_->interrupt_callback.opaque = this;
+
+	spdlog::trace("open {}", url_);
+	StallWatchdog::Arm(&deadline_, "open", g_open_timeout_ms);
+	int ret = TimedOut(avformat_open_input(&format_ctx_, url_.c_str(), NULL, &opt));
+	av_dict_free(&opt);
+	if (ret != 0)
+	{
+		//avformat_open_input frees the context on failure
+		format_ctx_ = nullptr;
+		err = "open input failed error: ";
+		err += av_err2str(ret);
+		spdlog::error("{} {}", url_, err);
+		return ret;
+	}
+
+	StallWatchdog::Arm(&deadline_, "probe", g_probe_timeout_ms);
+	ret = TimedOut(avformat_find_stream_info(format_ctx_, NULL));
+	spdlog::trace("wait... {}", url_);
+	if (ret < 0)
+	{
+		err = "open avformat_find_stream_info failed error: ";
+		err += av_err2str(ret);
+		spdlog::error("{} {}", url_, err);
+		avformat_close_input(&format_ctx_);
+		return ret;
+	}
+
+	//network protocols without an AVIOContext (rtsp) keep their buffers out of sight
+	if (format_ctx_->pb)
+	{
+		avio_bytes_ = format_ctx_->pb->buffer_size;
+		Charge(kMemoryAvio, avio_bytes_);
+	}
+	av_dump_format(format_ctx_, 0, url_.c_str(), 0);
+	return 0;
+}
+
+int StreamInput::Read(AVPacket *packet)
+{
+	{
+		std::lock_guard<std::mutex> lock(cache_mtx_);
+		if (!gop_cache_.empty())
+		{
+			AVPacket *cached = gop_cache_.front();
+			gop_cache_.pop_front();
+			cache_bytes_ -= cached->size;
+			Charge(kMemoryCache, -cached->size);
+			av_packet_move_ref(packet, cached);
+			av_packet_free(&cached);
+			return 0;
+		}
+	}
+
+	//a source that sends nothing for read_timeout_ms counts as stalled, the watchdog aborts the read
+	StallWatchdog::Arm(&deadline_, "read", g_read_timeout_ms);
+	return TimedOut(av_read_frame(format_ctx_, packet));
+}
+
+void StreamInput::StartStandby()
+{
+	standby_running_.store(true);
+	standby_thr_ = std::thread(&StreamInput::StandbyLoop, this);
+}
+
+bool StreamInput::StopStandby()
+{
+	if (!standby_thr_.joinable())
+	{
+		return false;
+	}
+	standby_running_.store(false);
+	if (!standby_ok_.load())
+	{
+		Interrupt();
+	}
+	standby_thr_.join();
+	return standby_ok_.load();
+}
+
+void StreamInput::Interrupt()
+{
+	interrupt_.store(true);
+}
+
+bool StreamInput::CompatibleWith(const std::vector<AVCodecParameters *> &layout) const
+{
+	if (!format_ctx_ || format_ctx_->nb_streams != layout.size())
+	{
+		return false;
+	}
+	for (unsigned i = 0; i < layout.size(); i++)
+	{
+		const AVCodecParameters *a = format_ctx_->streams[i]->codecpar;
+		const AVCodecParameters *b = layout[i];
+		if (a->codec_type != b->codec_type || a->codec_id != b->codec_id)
+		{
+			return false;
+		}
+		if (a->codec_type == AVMEDIA_TYPE_VIDEO && (a->width != b->width || a->height != b->height))
+		{
+			return false;
+		}
+		if (a->codec_type == AVMEDIA_TYPE_AUDIO && (a->sample_rate != b->sample_rate || a->channels != b->channels))
+		{
+			return false;
+		}
+		//the muxer already wrote the sequence header, a different one would break decoders
+		if (a->extradata_size && b->extradata_size &&
+			(a->extradata_size != b->extradata_size || memcmp(a->extradata, b->extradata, a->extradata_size) != 0))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+AVFormatContext *StreamInput::Context() const
+{
+	return format_ctx_;
+}
+
+const std::string &StreamInput::Url() const
+{
+	return url_;
+}
+
+//called by FFmpeg in every blocking wait, only flags are checked here
+int StreamInput::InterruptCallback(void *opaque)
+{
+	StreamInput *self = static_cast<StreamInput *>(opaque);
+	return self->interrupt_.load() || (self->running_ && !self->running_->load()) || StallWatchdog::Expired(&self->deadline_);
+}
+
+int StreamInput::TimedOut(int ret)
+{
+	//an aborted call reports AVERROR_EXIT, name the stall instead
+	if (ret < 0 && StallWatchdog::Expired(&deadline_))
+	{
+		ret = AVERROR(ETIMEDOUT);
+	}
+	StallWatchdog::Disarm(&deadline_);
+	return ret;
+}
+
+void StreamInput::StandbyLoop()
+{
+	std::string err;
+	if (Open(err) != 0)
+	{
+		spdlog::warn("standby {} not available: {}", url_, err);
+		return;
+	}
+	spdlog::info("standby {} warmed up", url_);
+
+	bool has_video = false;
+	for (unsigned i = 0; i < format_ctx_->nb_streams; i++)
+	{
+		has_video |= format_ctx_->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+	}
+
+	standby_ok_.store(true);
+	const size_t max_bytes = size_t(g_gop_cache_mb) << 20;
+	while (standby_running_.load())
+	{
+		AVPacket *packet = av_packet_alloc();
+		StallWatchdog::Arm(&deadline_, "read", g_read_timeout_ms);
+		int ret = TimedOut(av_read_frame(format_ctx_, packet));
+		if (ret < 0)
+		{
+			av_packet_free(&packet);
+			spdlog::warn("standby {} read failed: {}", url_, av_err2str(ret));
+			standby_ok_.store(false);
+			break;
+		}
+
+		bool key = (packet->flags & AV_PKT_FLAG_KEY) && (!has_video || format_ctx_->streams[packet->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO);
+		std::lock_guard<std::mutex> lock(cache_mtx_);
+		//over the memory budget the standby stays connected but caches nothing
+		if (key || g_memory_budget.ShedCaches())
+		{
+			ClearCache();
+		}
+		if (g_memory_budget.ShedCaches())
+		{
+			av_packet_free(&packet);
+			continue;
+		}
+		//a GOP longer than the cache is dropped whole, the switch then waits for the next key frame
+		if (gop_cache_.empty() && !key)
+		{
+			av_packet_free(&packet);
+			continue;
+		}
+		cache_bytes_ += packet->size;
+		Charge(kMemoryCache, packet->size);
+		gop_cache_.push_back(packet);
+		if (cache_bytes_ > max_bytes)
+		{
+			ClearCache();
+		}
+	}
+}
+
+void StreamInput::ClearCache()
+{
+	for (AVPacket *packet : gop_cache_)
+	{
+		av_packet_free(&packet);
+	}
+	gop_cache_.clear();
+	Charge(kMemoryCache, -int64_t(cache_bytes_));
+	cache_bytes_ = 0;
+}
+
+void StreamInput::Charge(MemoryKind kind, int64_t bytes)
+{
+	if (memory_ && bytes)
+	{
+		memory_->Add(kind, bytes);
+	}
+}
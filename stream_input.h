@@ -0,0 +1,61 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include "stall_watchdog.h"
+#include "memory_budget.h"
+
+struct AVFormatContext;
+struct AVPacket;
+struct AVCodecParameters;
+
+//One demuxed source. Besides plain reading it can run as a pre-warmed standby: a background thread
+//keeps the connection open and caches the packets since the last key frame, so a session switching
+//over starts on a key frame without waiting for the source.
+class StreamInput
+{
+public:
+    //running is the owning session's flag, clearing it aborts every blocking call at once, buffers
+    //and cached packets are charged to memory
+    StreamInput(const std::string &url, const std::atomic_bool *running = nullptr, MemoryAccount *memory = nullptr);
+    ~StreamInput();
+    int Open(std::string &err);
+    //cached standby packets come first, then the demuxer
+    int Read(AVPacket *packet);
+    void StartStandby();
+    //stops the background reader, returns false if the standby is not connected (an open in
+    //progress is aborted, the switch must not wait for it) or already failed
+    bool StopStandby();
+    //abort any blocking open or read, it returns AVERROR_EXIT
+    void Interrupt();
+    //same streams and codec setup as layout, so packets can go to a muxer created from it
+    bool CompatibleWith(const std::vector<AVCodecParameters *> &layout) const;
+    AVFormatContext *Context() const;
+    const std::string &Url() const;
+
+private:
+    static int InterruptCallback(void *opaque);
+    //disarms the deadline, ret becomes AVERROR(ETIMEDOUT) if the watchdog fired
+    int TimedOut(int ret);
+    void StandbyLoop();
+    void ClearCache();
+    void Charge(MemoryKind kind, int64_t bytes);
+
+    std::string url_;
+    AVFormatContext *format_ctx_ = nullptr;
+    const std::atomic_bool *running_;
+    MemoryAccount *memory_;
+    int64_t avio_bytes_ = 0;
+    std::atomic_bool interrupt_{false};
+    StallWatchdog::Deadline deadline_;
+
+    std::thread standby_thr_;
+    std::atomic_bool standby_running_{false};
+    std::atomic_bool standby_ok_{false};
+    std::mutex cache_mtx_;
+    std::deque<AVPacket *> gop_cache_;
+    size_t cache_bytes_ = 0;
+};
@@ -1,12 +1,51 @@
 #pragma once
 #include <string>
+#include <vector>
 #include <functional>
 
+struct TransformOptions
+{
+    std::string shm_name; //also publish packets into the ring /dev/shm/<shm_name>, empty disables
+    int dvr_minutes = 0;  //keep a time-shift buffer of the last minutes for replay, 0 disables
+    std::vector<std::string> backup_urls; //tried in order when the input fails, the output keeps running
+    bool standby = false; //keep the next backup connected with its last GOP cached for an instant switch
+    bool reconnect = false; //reopen a failed input in place before the session ends, the output stays up
+    int thin = 0;           //output only: 0 every frame, 1 key frames only, N key frames plus every Nth frame where references allow
+    bool video_only = false; //output only: leave out audio and data streams
+};
+
+struct TransformSessionInfo
+{
+    std::string input_url;
+    std::string output_url;
+    std::string shm_name;
+    int dvr_minutes = 0;
+    int thin = 0;
+    int64_t input_bitrate = 0; //bit/s, measured over the last second
+    std::string active_url;    //input_url or the backup currently feeding the output
+    int reconnects = 0;        //input reconnects and failovers done without restarting the output
+    int64_t last_reconnect_ms = 0; //from detecting the failure to the first packet of the new input
+    //bytes of the buffers the pipeline allocates itself, FFmpeg internals are not included
+    int64_t memory_packet = 0; //packet being remuxed
+    int64_t memory_avio = 0;   //input and output AVIO buffers
+    int64_t memory_cache = 0;  //standby GOP cache
+    int64_t memory_ring = 0;   //shm packet ring
+};
+
 class TransformStreamApi
 {
 public:
     virtual ~TransformStreamApi(){};
     virtual void set_media_host(const std::string &host_addr) = 0;
-    virtual void start(const std::string &input_url, std::string &output_url, const std::function<void(int, const std::string out_url, const std::string &err)> call_back) = 0;
-    virtual void stop(const std::string &input_url, std::string &err) = 0;
+    virtual void start(const std::string &input_url, std::string &output_url, const TransformOptions &options, const std::function<void(int, const std::string out_url, const std::string &err)> call_back) = 0;
+    //call_back gets the error, or an empty one once the session released its output, shm and dvr;
+    //it may run on another thread and right away, the caller is never blocked
+    virtual void stop(const std::string &input_url, const std::function<void(const std::string &err)> call_back) = 0;
+    //false if some sessions could not be listed, e.g. a worker did not answer; infos then holds the rest
+    virtual bool sessions(std::vector<TransformSessionInfo> &infos) = 0;
+    //play the time-shift buffer of input_url from offset_ms ago at speed until it reaches live, stop it with stop(output_url);
+    //output_url is named by the implementation when it comes in empty
+    virtual void replay(const std::string &input_url, int64_t offset_ms, double speed, std::string &output_url, std::string &err) = 0;
+    //child processes doing the media work, their cpu, memory, threads and fds count as this service's
+    virtual void worker_pids(std::vector<int> &pids) {}
 };
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 #include <assert.h>
+#include <unistd.h>
 #include <spdlog/spdlog.h>
 
 extern "C"
@@ -8,6 +11,19 @@ extern "C"
 #include <libavformat/avformat.h>
 }
 #include "transform_stream_impl.h"
+#include "shm_packet_ring.h"
+#include "dvr_buffer.h"
+#include "hash_ring.h"
+#include "stream_input.h"
+#include "frame_thinner.h"
+
+extern MemoryBudget g_memory_budget;
+TransformStreamFFmpeg::TransformStreamFFmpeg(const std::string &input_url, const std::string &output_url, const TransformOptions &options)
+	: input_url_(input_url), output_url_(output_url), options_(options), memory_(&g_memory_budget), output_guard_(&running_, output_url)
+{
+	urls_.push_back(input_url);
+	urls_.insert(urls_.end(), options.backup_urls.begin(), options.backup_urls.end());
+}
 
 TransformStreamFFmpeg::~TransformStreamFFmpeg()
 {
@@ -23,64 +39,136 @@ std::string TransformStreamFFmpeg::dstUrl() const
 	return output_url_;
 }
 
+int64_t TransformStreamFFmpeg::inputBitrate() const
+{
+	return input_bitrate_.load();
+}
+
+std::string TransformStreamFFmpeg::shmName() const
+{
+	return options_.shm_name;
+}
+
+int TransformStreamFFmpeg::dvrMinutes() const
+{
+	return options_.dvr_minutes;
+}
+
+int TransformStreamFFmpeg::thin() const
+{
+	return options_.thin;
+}
+
+std::string TransformStreamFFmpeg::activeUrl() const
+{
+	return urls_[active_.load()];
+}
+
+int TransformStreamFFmpeg::reconnects() const
+{
+	return reconnects_.load();
+}
+
+int64_t TransformStreamFFmpeg::lastReconnectMs() const
+{
+	return last_reconnect_ms_.load();
+}
+
+int64_t TransformStreamFFmpeg::memoryBytes(MemoryKind kind) const
+{
+	return memory_.Used(kind);
+}
+
+std::shared_ptr<DvrBuffer> TransformStreamFFmpeg::dvr()
+{
+	std::lock_guard<std::mutex> lock(dvr_mtx_);
+	return dvr_;
+}
+
+static void FillShmParams(const AVStream *stream, ShmStreamParams &params)
+{
+	const AVCodecParameters *par = stream->codecpar;
+	memset(&params, 0, sizeof(params));
+	params.codec_type = par->codec_type;
+	params.codec_id = par->codec_id;
+	params.codec_tag = par->codec_tag;
+	params.format = par->format;
+	params.bit_rate = par->bit_rate;
+	params.profile = par->profile;
+	params.level = par->level;
+	params.width = par->width;
+	params.height = par->height;
+	params.sample_aspect_num = par->sample_aspect_ratio.num;
+	params.sample_aspect_den = par->sample_aspect_ratio.den;
+	params.channels = par->channels;
+	params.sample_rate = par->sample_rate;
+	params.channel_layout = par->channel_layout;
+	params.frame_size = par->frame_size;
+	params.time_base_num = stream->time_base.num;
+	params.time_base_den = stream->time_base.den;
+	if (par->extradata && par->extradata_size <= kShmMaxExtradata)
+	{
+		params.extradata_size = par->extradata_size;
+		memcpy(params.extradata, par->extradata, par->extradata_size);
+	}
+}
+
+//copies of the first input's stream parameters, freed on every way out of start
+struct CodecLayout : std::vector<AVCodecParameters *>
+{
+	~CodecLayout()
+	{
+		for (AVCodecParameters *par : *this)
+		{
+			avcodec_parameters_free(&par);
+		}
+	}
+};
+
 extern std::string g_oformat;
-void TransformStreamFFmpeg::start(const std::string rtsp_url, const std::string rtmp_url, const std::function<void(int, const std::string out_url, const std::string &err)> call_back)
+extern int g_shm_ring_mb;
+extern std::string g_dvr_dir;
+extern int g_dvr_max_mb;
+extern int g_reconnect_attempts;
+extern int g_write_timeout_ms;
+void TransformStreamFFmpeg::start(const std::function<void(int, const std::string out_url, const std::string &err)> call_back)
 {
-	AVFormatContext *format_ctx;
+	const std::string &rtsp_url = input_url_;
+	const std::string &rtmp_url = output_url_;
+	const TransformOptions &options = options_;
+	std::unique_ptr<StreamInput> input, standby;
 	AVFormatContext *output_format = NULL;
+	CodecLayout layout;
+	std::vector<int> stream_map;
+	std::vector<std::unique_ptr<FrameThinner>> thinners;
+	std::unique_ptr<ShmPacketWriter> shm_writer;
+	std::shared_ptr<DvrBuffer> dvr;
 	std::string erroStr;
+	int64_t out_avio_bytes = 0, ring_bytes = 0;
 	int ret;
 	try
 	{
-		input_url_ = rtsp_url;
-		output_url_ = rtmp_url;
 		spdlog::info("input url: {}", rtsp_url);
 		spdlog::info("output url: {}", rtmp_url);
 
-		static bool is_inited = false;
-		if (!is_inited)
-		{
-			av_register_all();
-			avformat_network_init();
-			av_log_set_level(AV_LOG_INFO);
-			is_inited = true;
-		}
-
-		AVDictionary *opt = nullptr;
-		//av_dict_set(&opt,"buffer_size","1024000",0);
-		//av_dict_set(&opt,"max_delay","0",0);
-		av_dict_set(&opt, "rtsp_transport", "tcp", 0);
-		av_dict_set(&opt, "stimeout", "10000000", 0);
-
-		spdlog::trace("create {} AVFormatContext", rtsp_url);
-		format_ctx = avformat_alloc_context();
-
-		spdlog::trace("open {}", rtsp_url);
-		ret = avformat_open_input(&format_ctx, rtsp_url.c_str(), NULL, &opt);
-		if (ret != 0)
+		//the primary first, a backup only when everything before it failed to open
+		for (size_t i = 0; i < urls_.size() && running_.load() && !input; i++)
 		{
-			erroStr = "open input failed error: ";
-			erroStr += std::string(av_err2str(ret));
-			spdlog::error("{} {}", rtsp_url, erroStr);
-			avformat_free_context(format_ctx);
-			call_back(-1, rtmp_url, erroStr);
-			return;
+			input.reset(new StreamInput(urls_[i], &running_, &memory_));
+			if (input->Open(erroStr) != 0)
+			{
+				input.reset();
+				continue;
+			}
+			active_.store(i);
+			erroStr.clear();
 		}
-
-		ret = avformat_find_stream_info(format_ctx, NULL);
-		spdlog::trace("wait... {}", rtsp_url);
-		if (ret != 0)
+		if (!input)
 		{
-			erroStr = "open avformat_find_stream_info failed error: ";
-			erroStr += av_err2str(ret);
-			spdlog::error("{} {}", rtsp_url, erroStr);
-			avformat_free_context(format_ctx);
-			avformat_close_input(&format_ctx);
 			call_back(-1, rtmp_url, erroStr);
 			return;
 		}
-
-		av_dump_format(format_ctx, 0, rtsp_url.c_str(), 0);
+		AVFormatContext *format_ctx = input->Context();
 		spdlog::trace("prepare output context {}", rtsp_url);
 
 		ret = avformat_alloc_output_context2(&output_format, NULL, g_oformat.data(), rtmp_url.c_str());
@@ -90,15 +178,35 @@ void TransformStreamFFmpeg::start(const std::string rtsp_url, const std::string
 			erroStr = "open avformat_alloc_output_context2 failed error: ";
 			erroStr += av_err2str(ret);
 			spdlog::error("{} {}", rtsp_url, erroStr);
-			avformat_free_context(format_ctx);
 			avformat_free_context(output_format);
-			avformat_close_input(&format_ctx);
 			call_back(-1, rtmp_url, erroStr);
 			return;
 		}
-
+		//stop and a stalled publish target abort the muxer's blocking calls like the input's
+		output_format->interrupt_callback.callback = &OutputGuard::Callback;
+		output_format->interrupt_callback.opaque = &output_guard_;
+
+		//a thinned preview may leave out everything but video, stream_map points input streams at the
+		//output streams (-1 dropped) and layout is what a backup or a reconnect has to match
+		bool video_only = options.video_only;
+		if (video_only && av_find_best_stream(format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0) < 0)
+		{
+			spdlog::warn("{} has no video, video_only ignored", rtsp_url);
+			video_only = false;
+		}
 		for (int i = 0; i < format_ctx->nb_streams; i++)
 		{
+			AVCodecParameters *par = avcodec_parameters_alloc();
+			avcodec_parameters_copy(par, format_ctx->streams[i]->codecpar);
+			layout.push_back(par);
+			thinners.emplace_back(options.thin > 0 && par->codec_type == AVMEDIA_TYPE_VIDEO ? new FrameThinner(par, options.thin) : nullptr);
+			if (video_only && par->codec_type != AVMEDIA_TYPE_VIDEO)
+			{
+				stream_map.push_back(-1);
+				continue;
+			}
+			stream_map.push_back(output_format->nb_streams);
+
 			AVStream *out_stream = avformat_new_stream(output_format, NULL);
 			assert(out_stream != NULL);
 
@@ -110,9 +218,7 @@ void TransformStreamFFmpeg::start(const std::string rtsp_url, const std::string
 				erroStr = "avcodec_parameters_copy failed error: ";
 				erroStr += av_err2str(ret);
 				spdlog::error("{} {}", rtsp_url, erroStr);
-				avformat_free_context(format_ctx);
 				avformat_free_context(output_format);
-				avformat_close_input(&format_ctx);
 				call_back(-1, rtmp_url, erroStr);
 				return;
 			}
@@ -124,47 +230,151 @@ void TransformStreamFFmpeg::start(const std::string rtsp_url, const std::string
 
 		if (!(output_format->oformat->flags & AVFMT_NOFILE))
 		{
-			ret = avio_open(&output_format->pb, rtmp_url.c_str(), AVIO_FLAG_WRITE);
+			output_guard_.Arm("publish open", g_write_timeout_ms);
+			ret = output_guard_.Done(avio_open2(&output_format->pb, rtmp_url.c_str(), AVIO_FLAG_WRITE, &output_format->interrupt_callback, NULL));
 			if (ret != 0)
 			{
 				erroStr = "avio_open output failed error: ";
 				erroStr += av_err2str(ret);
 				spdlog::error("{} {}", rtsp_url, erroStr);
-				avformat_free_context(format_ctx);
 				avformat_free_context(output_format);
-				avformat_close_input(&format_ctx);
 				call_back(-1, rtmp_url, erroStr);
 				return;
 			}
+			out_avio_bytes = output_format->pb->buffer_size;
+			memory_.Add(kMemoryAvio, out_avio_bytes);
 		}
 
-		ret = avformat_write_header(output_format, NULL);
+		output_guard_.Arm("publish header", g_write_timeout_ms);
+		ret = output_guard_.Done(avformat_write_header(output_format, NULL));
 		if (ret != 0)
 		{
 			erroStr = "avformat_write_header failed error: ";
 			erroStr += av_err2str(ret);
 			spdlog::error("{} {}", rtsp_url, erroStr);
-			avformat_free_context(format_ctx);
-			avformat_free_context(output_format);
-			avformat_close_input(&format_ctx);
 			avio_close(output_format->pb);
+			avformat_free_context(output_format);
+			memory_.Add(kMemoryAvio, -out_avio_bytes);
 			call_back(-1, rtmp_url, erroStr);
 			return;
 		}
 
+		//the ring and the dvr carry input timestamps, every stream's time base is published with its params
+		ShmStreamParams params[kShmMaxStreams];
+		int nb_params = std::min<int>(format_ctx->nb_streams, kShmMaxStreams);
+		bool has_video = false;
+		for (int i = 0; i < nb_params; i++)
+		{
+			FillShmParams(format_ctx->streams[i], params[i]);
+			has_video |= params[i].codec_type == AVMEDIA_TYPE_VIDEO;
+		}
+
+		if (!options.shm_name.empty())
+		{
+			shm_writer.reset(new ShmPacketWriter);
+			if (shm_writer->Create(options.shm_name, uint64_t(g_shm_ring_mb) << 20, erroStr))
+			{
+				shm_writer->SetParams(params, nb_params);
+				ring_bytes = int64_t(g_shm_ring_mb) << 20;
+				memory_.Add(kMemoryRing, ring_bytes);
+				spdlog::info("{} publish packets to shm {}", rtsp_url, options.shm_name);
+			}
+			else
+			{
+				//the caller asked for the ring and would be told a name nobody writes, the start fails
+				spdlog::error("{} {}", rtsp_url, erroStr);
+				avio_close(output_format->pb);
+				avformat_free_context(output_format);
+				memory_.Add(kMemoryAvio, -out_avio_bytes);
+				call_back(-1, rtmp_url, erroStr);
+				return;
+			}
+		}
+
+		if (options.dvr_minutes > 0)
+		{
+			//every session gets its own file, a restarted session must not truncate or unlink the one
+			//that playbacks of the previous session still have mapped
+			static std::atomic<unsigned> dvr_seq{0};
+			char name[64];
+			snprintf(name, sizeof(name), "%016llx-%d-%u.dvr", (unsigned long long)HashRing::Hash(rtsp_url), (int)getpid(), dvr_seq++);
+			dvr = std::make_shared<DvrBuffer>();
+			if (dvr->Create(g_dvr_dir + "/" + name, uint64_t(g_dvr_max_mb) << 20, int64_t(options.dvr_minutes) * 60 * 1000000, erroStr))
+			{
+				dvr->SetParams(params, nb_params);
+				std::lock_guard<std::mutex> lock(dvr_mtx_);
+				dvr_ = dvr;
+				spdlog::info("{} keep {} minutes dvr in {}", rtsp_url, options.dvr_minutes, dvr->Path());
+			}
+			else
+			{
+				spdlog::error("{} {}", rtsp_url, erroStr);
+				erroStr.clear();
+				dvr.reset();
+			}
+		}
+
+		if (options.standby && urls_.size() > 1)
+		{
+			standby.reset(new StreamInput(urls_[(active_.load() + 1) % urls_.size()], &running_, &memory_));
+			standby->StartStandby();
+		}
+
+		//after a switch the new input's timestamps are shifted to continue where the output left off,
+		//the published time bases stay those of the first input
+		int64_t ts_offset_us = 0, end_us = 0, switch_begin = 0;
+		std::string failed_url;
+		bool rebase = false, waiting_key = false;
+		std::vector<int64_t> last_dts(output_format->nb_streams, AV_NOPTS_VALUE);
+		auto shift_ts = [&ts_offset_us](int64_t ts, AVRational from, AVRational to) {
+			if (ts == AV_NOPTS_VALUE)
+				return ts;
+			return av_rescale_q_rnd(ts, from, to, (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX)) + av_rescale_q(ts_offset_us, AV_TIME_BASE_Q, to);
+		};
+
 		int64_t start_time = av_gettime();
+		int64_t bitrate_window_start = start_time, bitrate_window_bytes = 0;
 		AVPacket packet;
-		running_.store(true);
 		while (running_.load())
 		{
 			AVStream *in_stream, *out_stream;
-			ret = av_read_frame(format_ctx, &packet);
+			ret = input->Read(&packet);
 			if (ret != 0)
 			{
-				break;
+				//without backups or reconnect there is nothing to switch to, the session ends
+				if (!running_.load() || (urls_.size() < 2 && !options.reconnect))
+				{
+					break;
+				}
+				spdlog::warn("{} input {} failed: {}", rtsp_url, input->Url(), av_err2str(ret));
+				switch_begin = av_gettime_relative();
+				failed_url = input->Url();
+				//release the dead connection first, some cameras only take a few clients
+				input.reset();
+				int rounds = options.reconnect ? std::max(1, g_reconnect_attempts) : 1;
+				for (int round = 0; round < rounds && running_.load() && !input; round++)
+				{
+					int64_t backoff_end = av_gettime_relative() + std::min<int64_t>(4000000, (int64_t)250000 << round);
+					while (round > 0 && running_.load() && av_gettime_relative() < backoff_end)
+					{
+						av_usleep(10000);
+					}
+					SwitchInput(input, standby, layout);
+				}
+				if (!input)
+				{
+					spdlog::error("{} no usable input left after {} ms, restart the session", rtsp_url, (av_gettime_relative() - switch_begin) / 1000);
+					break;
+				}
+				//the muxer already has its header, the new input joins on a key frame
+				rebase = true;
+				waiting_key = has_video;
+				continue;
 			}
 			else if (ret == 0)
 			{
+				//one packet is in flight at a time, its buffer replaces the previous one
+				memory_.Set(kMemoryPacket, packet.size);
 				if (is_first_frame_)
 				{
 					call_back(0, rtmp_url, "successful");
@@ -172,28 +382,123 @@ void TransformStreamFFmpeg::start(const std::string rtsp_url, const std::string
 				}
 			}
 
-			in_stream = format_ctx->streams[packet.stream_index];
-			out_stream = output_format->streams[packet.stream_index];
+			bitrate_window_bytes += packet.size;
+			int64_t window_time = av_gettime() - bitrate_window_start;
+			if (window_time >= 1000000)
+			{
+				input_bitrate_.store(bitrate_window_bytes * 8 * 1000000 / window_time);
+				bitrate_window_start += window_time;
+				bitrate_window_bytes = 0;
+			}
+
+			in_stream = input->Context()->streams[packet.stream_index];
 
-			if (in_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+			bool is_video = in_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+			if (waiting_key && !((packet.flags & AV_PKT_FLAG_KEY) && is_video))
+			{
+				av_packet_unref(&packet);
+				continue;
+			}
+			waiting_key = false;
+
+			int64_t dts = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
+			if (rebase && dts != AV_NOPTS_VALUE)
+			{
+				ts_offset_us = end_us - av_rescale_q(dts, in_stream->time_base, AV_TIME_BASE_Q);
+				rebase = false;
+				int64_t reconnect_ms = (av_gettime_relative() - switch_begin) / 1000;
+				reconnects_++;
+				last_reconnect_ms_.store(reconnect_ms);
+				if (input->Url() == failed_url)
+					spdlog::info("{} reconnected in place in {} ms, output kept", rtsp_url, reconnect_ms);
+				else
+					spdlog::info("{} switched to {} in {} ms", rtsp_url, input->Url(), reconnect_ms);
+			}
+			if (dts != AV_NOPTS_VALUE)
+			{
+				int64_t dts_end = av_rescale_q(dts + packet.duration, in_stream->time_base, AV_TIME_BASE_Q) + ts_offset_us;
+				end_us = std::max(end_us, dts_end);
+			}
+
+			if ((shm_writer || dvr) && packet.stream_index < kShmMaxStreams)
+			{
+				const ShmStreamParams &stream_params = params[packet.stream_index];
+				AVRational time_base = AVRational{stream_params.time_base_num, stream_params.time_base_den};
+				ShmPacketHeader shm_pkt;
+				memset(&shm_pkt, 0, sizeof(shm_pkt));
+				shm_pkt.size = packet.size;
+				shm_pkt.stream_index = packet.stream_index;
+				shm_pkt.flags = packet.flags;
+				shm_pkt.pts = shift_ts(packet.pts, in_stream->time_base, time_base);
+				shm_pkt.dts = shift_ts(packet.dts, in_stream->time_base, time_base);
+				shm_pkt.duration = av_rescale_q(packet.duration, in_stream->time_base, time_base);
+				if (shm_writer)
+				{
+					shm_writer->Write(shm_pkt, packet.data);
+				}
+				if (dvr)
+				{
+					bool key = (packet.flags & AV_PKT_FLAG_KEY) && (!has_video || stream_params.codec_type == AVMEDIA_TYPE_VIDEO);
+					dvr->Write(shm_pkt, packet.data, key);
+				}
+			}
+
+			if (is_video)
 			{
 				AVRational time_base = in_stream->time_base;
 				AVRational time_base_q = AV_TIME_BASE_Q;
-				int64_t pts_time = av_rescale_q(packet.dts, time_base, time_base_q);
+				int64_t pts_time = av_rescale_q(packet.dts, time_base, time_base_q) + ts_offset_us;
 				int64_t now_time = av_gettime() - start_time;
 				if (pts_time > now_time)
 					av_usleep(pts_time - now_time);
 			}
 
+			//thinning only touches the output, the ring and the dvr above keep every packet
+			FrameThinner *thinner = thinners[packet.stream_index].get();
+			int out_index = stream_map[packet.stream_index];
+			if (out_index < 0 || (thinner && !thinner->Keep(&packet)))
+			{
+				av_packet_unref(&packet);
+				continue;
+			}
+			out_stream = output_format->streams[out_index];
+			packet.stream_index = out_index;
+
 			//Convert PTS/DTS
 			//ac_rescale_q(a,b,c) = a * b / c
-			packet.pts = av_rescale_q_rnd(packet.pts, in_stream->time_base, out_stream->time_base, (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-			packet.dts = av_rescale_q_rnd(packet.dts, in_stream->time_base, out_stream->time_base, (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+			packet.pts = shift_ts(packet.pts, in_stream->time_base, out_stream->time_base);
+			packet.dts = shift_ts(packet.dts, in_stream->time_base, out_stream->time_base);
 			packet.duration = av_rescale_q(packet.duration, in_stream->time_base, out_stream->time_base);
+			if (options.thin == 1 && thinner && packet.pts != AV_NOPTS_VALUE)
+			{
+				//key frames alone have no reordering, the gap to the next one is unknown
+				packet.dts = packet.pts;
+				packet.duration = 0;
+			}
 
-			av_write_frame(output_format, &packet);
+			//the tail of the old input may overlap the head of the new one, the muxer wants increasing dts
+			int64_t &stream_last_dts = last_dts[packet.stream_index];
+			if (packet.dts != AV_NOPTS_VALUE && stream_last_dts != AV_NOPTS_VALUE && packet.dts < stream_last_dts)
+			{
+				av_packet_unref(&packet);
+				continue;
+			}
+			if (packet.dts != AV_NOPTS_VALUE)
+			{
+				stream_last_dts = packet.dts;
+			}
 
+			output_guard_.Arm("publish write", g_write_timeout_ms);
+			ret = output_guard_.Done(av_write_frame(output_format, &packet));
 			av_packet_unref(&packet);
+			if (ret < 0)
+			{
+				//the publish target is gone or stalled, the session ends and auto-replay restarts it
+				erroStr = "av_write_frame failed error: ";
+				erroStr += av_err2str(ret);
+				spdlog::error("{} {}", rtsp_url, erroStr);
+				break;
+			}
 		}
 	}
 	catch (const std::exception &e)
@@ -201,18 +506,33 @@ void TransformStreamFFmpeg::start(const std::string rtsp_url, const std::string
 		erroStr = e.what();
 		spdlog::critical("TransformStreamFFmpeg {} exception {}", rtsp_url, erroStr);
 	}
-	av_write_trailer(output_format);
-
-	if (!(output_format->oformat->flags & AVFMT_NOFILE))
+	shm_writer.reset();
+	memory_.Add(kMemoryRing, -ring_bytes);
+	memory_.Set(kMemoryPacket, 0);
+	if (dvr)
 	{
-		avio_close(output_format->pb);
+		//running playbacks keep the file until they drain it
+		dvr->Close();
+		std::lock_guard<std::mutex> lock(dvr_mtx_);
+		dvr_.reset();
 	}
-	avformat_close_input(&format_ctx);
-
-	avformat_free_context(output_format);
-	avformat_free_context(format_ctx);
+	//an exception may come before the output exists
+	if (output_format)
+	{
+		//after stop running_ is clear and the trailer is skipped, a stalled target is not waited for
+		output_guard_.Arm("publish trailer", g_write_timeout_ms);
+		av_write_trailer(output_format);
+		if (!(output_format->oformat->flags & AVFMT_NOFILE))
+		{
+			avio_close(output_format->pb);
+		}
+		output_guard_.Done(0);
+		avformat_free_context(output_format);
+		memory_.Add(kMemoryAvio, -out_avio_bytes);
+	}
+	standby.reset();
+	input.reset();
 
-	avformat_network_deinit();
 	if (running_.load())
 	{
 		if (ret != AVERROR_EOF)
@@ -234,17 +554,100 @@ void TransformStreamFFmpeg::start(const std::string rtsp_url, const std::string
 		}
 	}
 
+	input_bitrate_.store(0);
 	running_.store(false);
 }
 
+//Moves the session off the failed active input. The warm standby is taken when it is connected and
+//healthy, the other urls are opened in order otherwise, and with reconnect the failed url itself is
+//tried last. Inputs whose streams do not fit the running muxer are skipped, the caller falls back to a
+//full restart when none is left.
+bool TransformStreamFFmpeg::SwitchInput(std::unique_ptr<StreamInput> &input, std::unique_ptr<StreamInput> &standby, const std::vector<AVCodecParameters *> &layout)
+{
+	size_t count = urls_.size();
+	size_t candidates = options_.reconnect ? count : count - 1;
+	size_t failed = active_.load();
+	size_t next_index = failed;
+	std::unique_ptr<StreamInput> next;
+	for (size_t k = 1; k <= candidates && running_.load() && !next; k++)
+	{
+		next_index = (failed + k) % count;
+		//the standby always watches the url right after the active one
+		if (k == 1 && standby)
+		{
+			bool healthy = standby->StopStandby();
+			next = std::move(standby);
+			if (healthy && next->CompatibleWith(layout))
+			{
+				spdlog::info("{} take over from warm standby {}", input_url_, next->Url());
+				break;
+			}
+			next.reset();
+		}
+
+		std::string err;
+		next.reset(new StreamInput(urls_[next_index], &running_, &memory_));
+		if (next->Open(err) != 0)
+		{
+			next.reset();
+		}
+		else if (!next->CompatibleWith(layout))
+		{
+			spdlog::warn("{} streams of {} differ from the output, skipped", input_url_, urls_[next_index]);
+			next.reset();
+		}
+	}
+	if (!next)
+	{
+		return false;
+	}
+
+	input = std::move(next);
+	active_.store(next_index);
+	if (options_.standby && count > 1)
+	{
+		standby.reset(new StreamInput(urls_[(next_index + 1) % count], &running_, &memory_));
+		standby->StartStandby();
+	}
+	return true;
+}
+
 bool TransformStreamFFmpeg::stop()
 {
+	//the inputs' interrupt callbacks watch running_, a blocked open or read returns right away
 	running_.store(false);
+	return true;
 }
 
 TransformStream::TransformStream()
 {
 	index_.store(0);
+	reaper_ = std::thread(&TransformStream::ReapLoop, this);
+}
+
+TransformStream::~TransformStream()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		for (auto &item : transforms_)
+		{
+			item.second.session->stop();
+			Reap(item.second.thread);
+		}
+		transforms_.clear();
+		for (auto &item : playbacks_)
+		{
+			item.second.first->stop();
+			Reap(item.second.second);
+		}
+		playbacks_.clear();
+	}
+	{
+		std::lock_guard<std::mutex> lock(reap_mtx_);
+		quit_ = true;
+	}
+	reap_cv_.notify_one();
+	reaper_.join();
 }
 
 void TransformStream::set_media_host(const std::string &host_addr)
@@ -252,48 +655,296 @@ void TransformStream::set_media_host(const std::string &host_addr)
 	host_addr_ = host_addr;
 }
 
-void TransformStream::start(const std::string &input_url, std::string &output_url, const std::function<void(int, const std::string out_url, const std::string &err)> call_back)
+void TransformStream::start(const std::string &input_url, std::string &output_url, const TransformOptions &options, const std::function<void(int, const std::string out_url, const std::string &err)> call_back)
 {
-	std::lock_guard<std::mutex> lock(mtx_);
-	auto iter = transforms_.find(input_url);
-	if (iter != transforms_.end())
+	std::string existing_url;
 	{
-		std::string err("current transform existsing");
-		spdlog::warn("TransformStream::start {} {}", err, iter->second.first->dstUrl());
-		call_back(0, iter->second.first->dstUrl(), err);
-		return;
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto iter = transforms_.find(input_url);
+		if (iter == transforms_.end())
+		{
+			if (output_url.empty())
+			{
+				output_url = host_addr_ + "/" + std::to_string(index_++);
+			}
+			Launch(input_url, output_url, options, call_back);
+			return;
+		}
+
+		//a stopped session of this source may still publish to the same output, shm and dvr,
+		//the start runs once it let go; starts queued together share one output
+		if (iter->second.stopping)
+		{
+			std::vector<QueuedStart> &queued = iter->second.queued;
+			if (output_url.empty())
+			{
+				output_url = queued.empty() ? host_addr_ + "/" + std::to_string(index_++) : queued.front().output_url;
+			}
+			spdlog::info("TransformStream::start {} waits for the stopped session to finish", input_url);
+			queued.push_back(QueuedStart{output_url, options, call_back});
+			return;
+		}
+
+		//a concurrent start for a source that is still opening shares that open and its first frame result
+		output_url = existing_url = iter->second.session->dstUrl();
+		if (!iter->second.opened)
+		{
+			spdlog::info("TransformStream::start {} waits for the pending open", input_url);
+			iter->second.waiters.push_back(call_back);
+			return;
+		}
 	}
 
-	std::shared_ptr<TransformStreamFFmpeg> new_obj = std::make_shared<TransformStreamFFmpeg>();
-	if (output_url.empty())
+	std::string err("current transform existsing");
+	spdlog::warn("TransformStream::start {} {}", err, existing_url);
+	call_back(0, existing_url, err);
+}
+
+void TransformStream::Launch(const std::string &input_url, const std::string &output_url, const TransformOptions &options, const CallBack &call_back)
+{
+	Transform transform;
+	std::shared_ptr<TransformStreamFFmpeg> session = std::make_shared<TransformStreamFFmpeg>(input_url, output_url, options);
+	transform.session = session;
+	transform.owner = call_back;
+	transform.waiters.push_back(call_back);
+	//the thread owns the session, it outlives a stop until the reaper joins it
+	transform.thread = std::make_shared<std::thread>([this, input_url, session]() {
+		session->start(std::bind(&TransformStream::OnSessionEvent, this, input_url, session.get(), std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+		OnSessionFinished(input_url, session.get());
+	});
+	transforms_.insert(std::make_pair(input_url, transform));
+}
+
+void TransformStream::stop(const std::string &input_url, const std::function<void(const std::string &err)> call_back)
+{
+	std::vector<CallBack> waiters;
+	std::vector<QueuedStart> queued;
+	std::string out_url;
+	std::string err;
+	bool deferred = false;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto iter = transforms_.find(input_url);
+		auto play_iter = playbacks_.find(input_url);
+		if (iter == transforms_.end() && play_iter != playbacks_.end())
+		{
+			play_iter->second.first->stop();
+			Reap(play_iter->second.second);
+			playbacks_.erase(play_iter);
+		}
+		else if (iter == transforms_.end())
+		{
+			err = "transform not exists";
+			spdlog::warn("TransformStream::stop source {} transform not exists", input_url);
+		}
+		else
+		{
+			//the caller may hand the output url to somebody else right after, e.g. a cluster give back,
+			//so it is answered only once the session stopped publishing
+			iter->second.stopped.push_back(call_back);
+			deferred = true;
+			queued.swap(iter->second.queued);
+			if (!iter->second.stopping)
+			{
+				iter->second.session->stop();
+				iter->second.stopping = true;
+				out_url = iter->second.session->dstUrl();
+				waiters.swap(iter->second.waiters);
+			}
+			else
+			{
+				spdlog::info("TransformStream::stop source {} already stopping", input_url);
+			}
+		}
+	}
+
+	for (auto &waiter : waiters)
+	{
+		waiter(-1, out_url, "transform stopped");
+	}
+	//starts that were waiting for an earlier stop are stopped with it
+	for (auto &start : queued)
+	{
+		start.call_back(-1, start.output_url, "transform stopped");
+	}
+	if (!deferred)
 	{
-		output_url = host_addr_ + "/" + std::to_string(index_++);
+		call_back(err);
 	}
-	std::shared_ptr<std::thread> new_thr = std::make_shared<std::thread>(std::bind(&TransformStreamFFmpeg::start, new_obj.get(), input_url, output_url, call_back));
-	bool code = transforms_.insert(std::make_pair(input_url, std::make_pair(new_obj, new_thr))).second;
-	if (!code)
+}
+
+void TransformStream::OnSessionEvent(const std::string &input_url, const TransformStreamFFmpeg *session, int code, const std::string out_url, const std::string &err)
+{
+	std::vector<CallBack> waiters;
+	CallBack owner;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto iter = transforms_.find(input_url);
+		//a stopped or replaced session has nobody left to tell
+		if (iter == transforms_.end() || iter->second.session.get() != session || iter->second.stopping)
+		{
+			return;
+		}
+
+		waiters.swap(iter->second.waiters);
+		if (code == 0)
+		{
+			iter->second.opened = true;
+		}
+		else
+		{
+			//the entry goes now, so the next start opens the source again instead of joining a dead one;
+			//before the first frame the owner is still among the waiters and must not hear it twice
+			if (code == -2 && iter->second.opened)
+			{
+				owner = iter->second.owner;
+			}
+			Reap(iter->second.thread);
+			transforms_.erase(iter);
+		}
+	}
+
+	for (auto &waiter : waiters)
+	{
+		waiter(code, out_url, err);
+	}
+	if (owner)
+	{
+		owner(code, out_url, err);
+	}
+}
+
+void TransformStream::OnSessionFinished(const std::string &input_url, const TransformStreamFFmpeg *session)
+{
+	std::vector<StopCallBack> stopped;
+	std::vector<QueuedStart> queued;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto iter = transforms_.find(input_url);
+		if (iter != transforms_.end() && iter->second.session.get() == session)
+		{
+			stopped.swap(iter->second.stopped);
+			queued.swap(iter->second.queued);
+			Reap(iter->second.thread);
+			transforms_.erase(iter);
+		}
+	}
+
+	for (auto &call_back : stopped)
 	{
-		spdlog::error("TransformStream::start {} faild", input_url);
+		call_back("");
+	}
+	//the first queued start opens the source again, the others join it
+	for (auto &start : queued)
+	{
+		this->start(input_url, start.output_url, start.options, start.call_back);
 	}
 }
 
-void TransformStream::stop(const std::string &input_url, std::string &err)
+void TransformStream::Reap(const std::shared_ptr<std::thread> &thr)
+{
+	std::lock_guard<std::mutex> lock(reap_mtx_);
+	reap_queue_.push_back(thr);
+	reap_cv_.notify_one();
+}
+
+void TransformStream::ReapLoop()
+{
+	while (true)
+	{
+		std::vector<std::shared_ptr<std::thread>> threads;
+		{
+			std::unique_lock<std::mutex> lock(reap_mtx_);
+			reap_cv_.wait(lock, [this] { return quit_ || !reap_queue_.empty(); });
+			if (reap_queue_.empty())
+			{
+				return;
+			}
+			threads.swap(reap_queue_);
+		}
+		for (auto &thr : threads)
+		{
+			if (thr->joinable())
+			{
+				thr->join();
+			}
+		}
+	}
+}
+
+bool TransformStream::sessions(std::vector<TransformSessionInfo> &infos)
 {
 	std::lock_guard<std::mutex> lock(mtx_);
+	for (auto &item : transforms_)
+	{
+		if (item.second.stopping)
+		{
+			continue;
+		}
+		TransformSessionInfo info;
+		info.input_url = item.first;
+		info.output_url = item.second.session->dstUrl();
+		info.input_bitrate = item.second.session->inputBitrate();
+		info.shm_name = item.second.session->shmName();
+		info.dvr_minutes = item.second.session->dvrMinutes();
+		info.thin = item.second.session->thin();
+		info.active_url = item.second.session->activeUrl();
+		info.reconnects = item.second.session->reconnects();
+		info.last_reconnect_ms = item.second.session->lastReconnectMs();
+		info.memory_packet = item.second.session->memoryBytes(kMemoryPacket);
+		info.memory_avio = item.second.session->memoryBytes(kMemoryAvio);
+		info.memory_cache = item.second.session->memoryBytes(kMemoryCache);
+		info.memory_ring = item.second.session->memoryBytes(kMemoryRing);
+		infos.push_back(info);
+	}
+	return true;
+}
+
+void TransformStream::replay(const std::string &input_url, int64_t offset_ms, double speed, std::string &output_url, std::string &err)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	//finished playbacks are cleaned up here, nobody else waits for them
+	for (auto iter = playbacks_.begin(); iter != playbacks_.end();)
+	{
+		if (!iter->second.first->running())
+		{
+			Reap(iter->second.second);
+			iter = playbacks_.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+
 	auto iter = transforms_.find(input_url);
-	if (iter == transforms_.end())
+	std::shared_ptr<DvrBuffer> dvr;
+	if (iter == transforms_.end() || iter->second.stopping || !(dvr = iter->second.session->dvr()))
+	{
+		err = "transform not exists or has no dvr";
+		spdlog::warn("TransformStream::replay {} {}", input_url, err);
+		return;
+	}
+
+	uint64_t pos;
+	int64_t actual_offset_us;
+	if (!dvr->Locate(offset_ms * 1000, pos, actual_offset_us))
 	{
-		err = "transform not exists";
-		spdlog::warn("TransformStream::stop source {} transform not exists", input_url);
+		err = "dvr has no key frame yet";
+		spdlog::warn("TransformStream::replay {} {}", input_url, err);
 		return;
 	}
+	if (actual_offset_us / 1000 < offset_ms - 1000)
+	{
+		spdlog::warn("TransformStream::replay {} offset {}ms clamped to {}ms", input_url, offset_ms, actual_offset_us / 1000);
+	}
 
-	auto obj = iter->second.first;
-	auto thr = iter->second.second;
-	obj->stop();
-	if (thr->joinable())
+	if (output_url.empty())
 	{
-		thr->join();
+		output_url = host_addr_ + "/replay_" + std::to_string(index_++);
 	}
-	transforms_.erase(iter);
+	std::shared_ptr<DvrPlayback> new_obj = std::make_shared<DvrPlayback>(dvr, pos, speed, output_url);
+	std::shared_ptr<std::thread> new_thr = std::make_shared<std::thread>(std::bind(&DvrPlayback::start, new_obj));
+	playbacks_.insert(std::make_pair(output_url, std::make_pair(new_obj, new_thr)));
+	spdlog::info("TransformStream::replay {} from {}ms ago at {}x to {}", input_url, actual_offset_us / 1000, speed, output_url);
 }
\ No newline at end of file
@@ -4,35 +4,104 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <vector>
+#include <condition_variable>
 #include "transform_stream_api.h"
+#include "memory_budget.h"
+#include "stall_watchdog.h"
+
+class DvrBuffer;
+class DvrPlayback;
+class StreamInput;
+struct AVCodecParameters;
 
 class TransformStreamFFmpeg
 {
 public:
-    TransformStreamFFmpeg() = default;
+    TransformStreamFFmpeg(const std::string &input_url, const std::string &output_url, const TransformOptions &options);
     ~TransformStreamFFmpeg();
     std::string src() const;
     std::string dstUrl() const;
-    void start(const std::string input_url, const std::string output_url, const std::function<void(int, const std::string out_url, const std::string &err)> call_back);
+    int64_t inputBitrate() const;
+    std::string shmName() const;
+    int dvrMinutes() const;
+    int thin() const;
+    std::string activeUrl() const;
+    int reconnects() const;
+    int64_t lastReconnectMs() const;
+    int64_t memoryBytes(MemoryKind kind) const;
+    std::shared_ptr<DvrBuffer> dvr();
+    void start(const std::function<void(int, const std::string out_url, const std::string &err)> call_back);
     bool stop();
 
 private:
-    std::atomic_bool running_;
+    bool SwitchInput(std::unique_ptr<StreamInput> &input, std::unique_ptr<StreamInput> &standby, const std::vector<AVCodecParameters *> &layout);
+
+    std::atomic_bool running_{true};
     std::string input_url_, output_url_;
+    TransformOptions options_;
+    std::vector<std::string> urls_; //input_url_ followed by the backups
+    std::atomic<size_t> active_{0};
+    std::atomic_int reconnects_{0};
+    std::atomic<int64_t> last_reconnect_ms_{0};
     bool is_first_frame_ = true;
+    std::atomic<int64_t> input_bitrate_{0};
+    MemoryAccount memory_;
+    OutputGuard output_guard_;
+    std::mutex dvr_mtx_;
+    std::shared_ptr<DvrBuffer> dvr_;
 };
 
 class TransformStream : public TransformStreamApi
 {
 public:
     TransformStream();
+    ~TransformStream();
     void set_media_host(const std::string &host_addr) override;
-    void start(const std::string &input_url, std::string &output_url, const std::function<void(int, const std::string out_url, const std::string &err)> call_back) override;
-    void stop(const std::string &input_url, std::string &err) override;
+    void start(const std::string &input_url, std::string &output_url, const TransformOptions &options, const std::function<void(int, const std::string out_url, const std::string &err)> call_back) override;
+    void stop(const std::string &input_url, const std::function<void(const std::string &err)> call_back) override;
+    bool sessions(std::vector<TransformSessionInfo> &infos) override;
+    void replay(const std::string &input_url, int64_t offset_ms, double speed, std::string &output_url, std::string &err) override;
 
 private:
+    typedef std::function<void(int, const std::string out_url, const std::string &err)> CallBack;
+    typedef std::function<void(const std::string &err)> StopCallBack;
+    //a start for a source whose stopped session has not let go yet
+    struct QueuedStart
+    {
+        std::string output_url;
+        TransformOptions options;
+        CallBack call_back;
+    };
+    struct Transform
+    {
+        std::shared_ptr<TransformStreamFFmpeg> session;
+        std::shared_ptr<std::thread> thread;
+        bool opened = false;           //first frame was read
+        bool stopping = false;         //stopped, kept until the thread released the output, shm and dvr
+        CallBack owner;                //the start call that opened the source, told when the session ends
+        std::vector<CallBack> waiters; //every start call waiting for the first frame, owner included
+        std::vector<StopCallBack> stopped; //stop calls answered once the thread is done
+        std::vector<QueuedStart> queued;   //started again from OnSessionFinished
+    };
+    //called with mtx_ held
+    void Launch(const std::string &input_url, const std::string &output_url, const TransformOptions &options, const CallBack &call_back);
+    void OnSessionEvent(const std::string &input_url, const TransformStreamFFmpeg *session, int code, const std::string out_url, const std::string &err);
+    //last thing on the session thread, everything the session published is released by then
+    void OnSessionFinished(const std::string &input_url, const TransformStreamFFmpeg *session);
+    void Reap(const std::shared_ptr<std::thread> &thr);
+    void ReapLoop();
+
     std::mutex mtx_;
     std::atomic_int index_;
     std::string host_addr_;
-    std::map<std::string, std::pair<std::shared_ptr<TransformStreamFFmpeg>, std::shared_ptr<std::thread>>> transforms_;
+    std::map<std::string, Transform> transforms_;
+    std::map<std::string, std::pair<std::shared_ptr<DvrPlayback>, std::shared_ptr<std::thread>>> playbacks_;
+
+    //stopped and finished session threads are joined here, never on a caller's thread
+    std::mutex reap_mtx_;
+    std::condition_variable reap_cv_;
+    std::vector<std::shared_ptr<std::thread>> reap_queue_;
+    bool quit_ = false;
+    std::thread reaper_;
 };
\ No newline at end of file
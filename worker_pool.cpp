@@ -0,0 +1,865 @@
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "spdlog/spdlog.h"
+#include "worker_pool.h"
+#include "dvr_buffer.h"
+
+extern std::string g_dvr_dir;
+
+using namespace web;
+
+namespace
+{
+    int64_t NowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    json::value OptionsToJson(const TransformOptions &options)
+    {
+        auto value = json::value::object();
+        value["shm"] = json::value::string(options.shm_name);
+        value["dvr"] = json::value::number(options.dvr_minutes);
+        auto backups = json::value::array(options.backup_urls.size());
+        for (size_t i = 0; i < options.backup_urls.size(); i++)
+        {
+            backups[i] = json::value::string(options.backup_urls[i]);
+        }
+        value["backup_urls"] = backups;
+        value["standby"] = json::value::boolean(options.standby);
+        value["reconnect"] = json::value::boolean(options.reconnect);
+        value["thin"] = json::value::number(options.thin);
+        value["video_only"] = json::value::boolean(options.video_only);
+        return value;
+    }
+
+    TransformOptions OptionsFromJson(const json::value &value)
+    {
+        TransformOptions options;
+        options.shm_name = value.at("shm").as_string();
+        options.dvr_minutes = value.at("dvr").as_integer();
+        for (const json::value &backup : value.at("backup_urls").as_array())
+        {
+            options.backup_urls.push_back(backup.as_string());
+        }
+        options.standby = value.at("standby").as_bool();
+        options.reconnect = value.at("reconnect").as_bool();
+        options.thin = value.at("thin").as_integer();
+        options.video_only = value.at("video_only").as_bool();
+        return options;
+    }
+} // namespace
+
+IpcChannel::IpcChannel(int fd) : fd_(fd)
+{
+}
+
+IpcChannel::~IpcChannel()
+{
+    close(fd_);
+}
+
+bool IpcChannel::Send(const json::value &message)
+{
+    //serialize escapes newlines inside strings, a raw one only ends a message
+    std::string line = message.serialize() + "\n";
+    std::lock_guard<std::mutex> lock(write_mtx_);
+    size_t sent = 0;
+    while (sent < line.size())
+    {
+        ssize_t ret = send(fd_, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        sent += ret;
+    }
+    return true;
+}
+
+bool IpcChannel::Receive(json::value &message)
+{
+    size_t pos;
+    while ((pos = buffer_.find('\n')) == std::string::npos)
+    {
+        char chunk[4096];
+        ssize_t ret = read(fd_, chunk, sizeof(chunk));
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        buffer_.append(chunk, ret);
+    }
+    std::string line = buffer_.substr(0, pos);
+    buffer_.erase(0, pos + 1);
+    message = json::value::parse(line);
+    return true;
+}
+
+void IpcChannel::Shutdown()
+{
+    shutdown(fd_, SHUT_RDWR);
+}
+
+WorkerPool::WorkerPool(int workers, const std::string &config_file) : config_file_(config_file)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (int i = 0; i < workers; i++)
+    {
+        workers_.emplace_back(new Worker);
+        workers_.back()->slot = i;
+        if (!Spawn(*workers_.back()))
+        {
+            crashed_.push_back(i);
+        }
+    }
+    restarter_ = std::thread(&WorkerPool::RestartLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        quit_.store(true);
+    }
+    cv_.notify_all();
+    restarter_.join();
+
+    //workers stop their sessions and exit once the channel closes
+    for (auto &worker : workers_)
+    {
+        if (worker->channel)
+        {
+            worker->channel->Shutdown();
+        }
+        if (worker->reader.joinable())
+        {
+            worker->reader.join();
+        }
+        if (worker->pid > 0)
+        {
+            waitpid(worker->pid, NULL, 0);
+        }
+    }
+}
+
+void WorkerPool::set_media_host(const std::string &host_addr)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    host_addr_ = host_addr;
+}
+
+void WorkerPool::start(const std::string &input_url, std::string &output_url, const TransformOptions &options, const std::function<void(int, const std::string out_url, const std::string &err)> call_back)
+{
+    json::value message;
+    int slot;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        Pending pending;
+        pending.input_url = input_url;
+        pending.call_back = call_back;
+        auto iter = sessions_.find(input_url);
+        if (iter == sessions_.end() || iter->second.stopping)
+        {
+            //output urls are named here, every worker counting on its own would hand out the same ones
+            if (output_url.empty())
+            {
+                output_url = host_addr_ + "/" + std::to_string(index_++);
+            }
+            ProxySession session;
+            session.slot = PickWorker(-1);
+            session.generation = next_id_++;
+            session.output_url = output_url;
+            session.options = options;
+            sessions_[input_url] = session;
+            iter = sessions_.find(input_url);
+            pending.owner = true;
+        }
+        output_url = iter->second.output_url;
+        slot = iter->second.slot;
+        pending.generation = iter->second.generation;
+
+        int64_t id = next_id_++;
+        pending_[id] = pending;
+        message = StartMessage(id, input_url, iter->second);
+    }
+
+    //if the worker is gone the restart restores this start together with its session
+    std::shared_ptr<IpcChannel> channel = Channel(slot);
+    if (channel)
+    {
+        channel->Send(message);
+    }
+}
+
+void WorkerPool::stop(const std::string &input_url, const std::function<void(const std::string &err)> call_back)
+{
+    std::vector<int> slots;
+    std::vector<int64_t> stopped_ids;
+    int64_t generation = -1;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto iter = sessions_.find(input_url);
+        auto play_iter = replays_.find(input_url);
+        //only what exists now is stopped, a start coming in meanwhile is left alone
+        for (auto &pending : pending_)
+        {
+            if (pending.second.input_url == input_url)
+                stopped_ids.push_back(pending.first);
+        }
+        if (iter != sessions_.end())
+        {
+            slots.push_back(iter->second.slot);
+            generation = iter->second.generation;
+            iter->second.stopping = true;
+        }
+        else if (play_iter != replays_.end())
+        {
+            slots.push_back(play_iter->second);
+        }
+        else
+        {
+            //not known here, it may have been started again just as its old session ended
+            for (auto &worker : workers_)
+            {
+                slots.push_back(worker->slot);
+            }
+        }
+    }
+
+    //workers answer once their session let go of the output, which may take a write timeout;
+    //the last answer finishes the stop
+    struct StopState
+    {
+        std::mutex mtx;
+        size_t remaining = 0;
+        bool stopped = false;
+    };
+    auto state = std::make_shared<StopState>();
+    state->remaining = slots.size();
+    auto finish = [this, state, input_url, generation, stopped_ids, call_back](const json::value *reply) {
+        {
+            std::lock_guard<std::mutex> lock(state->mtx);
+            //a worker that went away took a known session with it, that is stopped as well
+            if (reply ? reply->at("err").as_string().empty() : generation >= 0)
+            {
+                state->stopped = true;
+            }
+            if (--state->remaining > 0)
+            {
+                return;
+            }
+        }
+
+        //waiters of the stopped session were told by the worker before it replied
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto iter = sessions_.find(input_url);
+            if (iter != sessions_.end() && iter->second.generation == generation)
+            {
+                sessions_.erase(iter);
+            }
+            replays_.erase(input_url);
+            for (int64_t id : stopped_ids)
+            {
+                pending_.erase(id);
+            }
+        }
+        call_back(state->stopped ? "" : "transform not exists");
+    };
+
+    auto message = json::value::object();
+    message["op"] = json::value::string("stop");
+    message["url"] = json::value::string(input_url);
+    for (int slot : slots)
+    {
+        CallAsync(slot, message, finish);
+    }
+}
+
+bool WorkerPool::sessions(std::vector<TransformSessionInfo> &infos)
+{
+    std::vector<int> slots;
+    size_t workers;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto &worker : workers_)
+        {
+            if (worker->alive)
+                slots.push_back(worker->slot);
+        }
+        workers = workers_.size();
+    }
+
+    //a worker being restarted or too slow to answer leaves its sessions out, the caller must know
+    auto message = json::value::object();
+    message["op"] = json::value::string("sessions");
+    std::map<int, json::value> replies = CallEach(slots, message);
+    for (auto &reply : replies)
+    {
+        for (const json::value &item : reply.second.at("sessions").as_array())
+        {
+            TransformSessionInfo info;
+            info.input_url = item.at("url").as_string();
+            info.output_url = item.at("output_url").as_string();
+            info.shm_name = item.at("shm").as_string();
+            info.dvr_minutes = item.at("dvr").as_integer();
+            info.thin = item.at("thin").as_integer();
+            info.input_bitrate = item.at("input_bitrate").as_number().to_int64();
+            info.active_url = item.at("active_url").as_string();
+            info.reconnects = item.at("reconnects").as_integer();
+            info.last_reconnect_ms = item.at("last_reconnect_ms").as_number().to_int64();
+            const json::value &memory = item.at("memory");
+            info.memory_packet = memory.at("packet").as_number().to_int64();
+            info.memory_avio = memory.at("avio").as_number().to_int64();
+            info.memory_cache = memory.at("cache").as_number().to_int64();
+            info.memory_ring = memory.at("ring").as_number().to_int64();
+            infos.push_back(info);
+        }
+    }
+    return replies.size() == workers;
+}
+
+void WorkerPool::replay(const std::string &input_url, int64_t offset_ms, double speed, std::string &output_url, std::string &err)
+{
+    int slot;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto iter = sessions_.find(input_url);
+        if (iter == sessions_.end())
+        {
+            err = "transform not exists";
+            return;
+        }
+        slot = iter->second.slot;
+        output_url = host_addr_ + "/replay_" + std::to_string(index_++);
+    }
+
+    auto message = json::value::object();
+    message["op"] = json::value::string("replay");
+    message["url"] = json::value::string(input_url);
+    message["offset_ms"] = json::value::number(offset_ms);
+    message["speed"] = json::value::number(speed);
+    message["output_url"] = json::value::string(output_url);
+    json::value reply;
+    if (!Call(slot, message, reply))
+    {
+        err = "worker unavailable";
+        return;
+    }
+    err = reply.at("err").as_string();
+    if (err.empty())
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        replays_[output_url] = slot;
+    }
+}
+
+void WorkerPool::worker_pids(std::vector<int> &pids)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto &worker : workers_)
+    {
+        if (worker->alive && worker->pid > 0)
+            pids.push_back(worker->pid);
+    }
+}
+
+//called with mtx_ held
+bool WorkerPool::Spawn(Worker &worker)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+    {
+        spdlog::error("WorkerPool socketpair failed: {}", strerror(errno));
+        return false;
+    }
+
+    //only async-signal-safe calls between fork and exec, the arguments are built before
+    std::string fd_arg = std::to_string(fds[1]);
+    std::string slot_arg = std::to_string(worker.slot);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        fcntl(fds[1], F_SETFD, 0);
+        execl("/proc/self/exe", "video_transform_micro_server", config_file_.c_str(), "--worker", fd_arg.c_str(), slot_arg.c_str(), (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0)
+    {
+        spdlog::error("WorkerPool fork failed: {}", strerror(errno));
+        close(fds[0]);
+        return false;
+    }
+
+    worker.pid = pid;
+    worker.alive = true;
+    worker.spawned_ms = NowMs();
+    worker.channel = std::make_shared<IpcChannel>(fds[0]);
+    worker.reader = std::thread(&WorkerPool::ReadLoop, this, &worker, worker.channel);
+    spdlog::info("WorkerPool worker {} started, pid {}", worker.slot, pid);
+    return true;
+}
+
+void WorkerPool::ReadLoop(Worker *worker, std::shared_ptr<IpcChannel> channel)
+{
+    json::value message;
+    while (channel->Receive(message))
+    {
+        try
+        {
+            std::string op = message.at("op").as_string();
+            if (op == "event")
+            {
+                OnEvent(worker->slot, message);
+            }
+            else if (op == "reply")
+            {
+                ReplyFunc done;
+                {
+                    std::lock_guard<std::mutex> lock(mtx_);
+                    int64_t id = message.at("id").as_number().to_int64();
+                    auto iter = async_calls_.find(id);
+                    if (iter != async_calls_.end())
+                    {
+                        done = iter->second.done;
+                        async_calls_.erase(iter);
+                    }
+                    else if (calls_.count(id))
+                    {
+                        replies_[id] = message;
+                        cv_.notify_all();
+                    }
+                }
+                if (done)
+                {
+                    done(&message);
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            spdlog::error("WorkerPool worker {} bad message: {}", worker->slot, e.what());
+        }
+    }
+
+    std::vector<ReplyFunc> unanswered;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        worker->alive = false;
+        if (!quit_.load())
+        {
+            crashed_.push_back(worker->slot);
+        }
+        for (auto iter = async_calls_.begin(); iter != async_calls_.end();)
+        {
+            if (iter->second.channel == channel)
+            {
+                unanswered.push_back(iter->second.done);
+                iter = async_calls_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+    cv_.notify_all();
+    for (auto &done : unanswered)
+    {
+        done(nullptr);
+    }
+}
+
+void WorkerPool::RestartLoop()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (true)
+    {
+        cv_.wait(lock, [this] { return quit_.load() || !crashed_.empty(); });
+        if (quit_.load())
+        {
+            break;
+        }
+        int slot = crashed_.front();
+        crashed_.erase(crashed_.begin());
+        Worker &worker = *workers_[slot];
+        std::thread reader = std::move(worker.reader);
+        pid_t pid = worker.pid;
+        int64_t uptime_ms = NowMs() - worker.spawned_ms;
+
+        lock.unlock();
+        if (reader.joinable())
+        {
+            reader.join();
+        }
+        int status = 0;
+        if (pid > 0)
+        {
+            waitpid(pid, &status, 0);
+            spdlog::error("WorkerPool worker {} pid {} exited, status {}", slot, pid, status);
+            //a worker that crashed did not unlink its time-shift buffers
+            DvrBuffer::Sweep(g_dvr_dir);
+        }
+        //a worker that dies right away would otherwise be restarted in a tight loop
+        if (uptime_ms < 1000)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        lock.lock();
+        if (quit_.load())
+        {
+            break;
+        }
+
+        worker.pid = -1;
+        if (!Spawn(worker))
+        {
+            worker.spawned_ms = NowMs();
+            crashed_.push_back(slot);
+        }
+
+        //sessions move to the least loaded worker that is still up, the owner is started first so
+        //the other callers join its open
+        std::vector<std::pair<int, json::value>> messages;
+        for (auto &item : sessions_)
+        {
+            //a stopped session went with the worker, its stop was answered when the reader ended
+            if (item.second.slot != slot || item.second.stopping)
+            {
+                continue;
+            }
+            item.second.slot = PickWorker(slot);
+            std::vector<int64_t> ids;
+            for (auto &pending : pending_)
+            {
+                if (pending.second.input_url != item.first)
+                    continue;
+                if (pending.second.owner)
+                    ids.insert(ids.begin(), pending.first);
+                else
+                    ids.push_back(pending.first);
+            }
+            if (ids.empty() || !pending_[ids[0]].owner)
+            {
+                Pending owner;
+                owner.input_url = item.first;
+                owner.generation = item.second.generation;
+                owner.owner = true;
+                owner.opened = true;
+                ids.insert(ids.begin(), next_id_);
+                pending_[next_id_++] = owner;
+            }
+            for (int64_t id : ids)
+            {
+                messages.push_back(std::make_pair(item.second.slot, StartMessage(id, item.first, item.second)));
+            }
+            spdlog::info("WorkerPool restore {} of worker {} on worker {}", item.first, slot, item.second.slot);
+        }
+        //playbacks are not restored, their source session starts a new time-shift buffer
+        for (auto iter = replays_.begin(); iter != replays_.end();)
+        {
+            if (iter->second == slot)
+                iter = replays_.erase(iter);
+            else
+                ++iter;
+        }
+
+        lock.unlock();
+        for (auto &message : messages)
+        {
+            std::shared_ptr<IpcChannel> channel = Channel(message.first);
+            if (channel)
+            {
+                channel->Send(message.second);
+            }
+        }
+        lock.lock();
+    }
+}
+
+void WorkerPool::OnEvent(int slot, const json::value &message)
+{
+    int64_t id = message.at("id").as_number().to_int64();
+    int code = message.at("code").as_integer();
+    std::string out_url = message.at("out_url").as_string();
+    std::string err = message.at("err").as_string();
+    CallBack call_back;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto iter = pending_.find(id);
+        if (iter == pending_.end())
+        {
+            return;
+        }
+        Pending &pending = iter->second;
+        if (code == 0)
+        {
+            //a restored session reports its first frame again, the caller already had it
+            if (!pending.opened)
+            {
+                call_back = pending.call_back;
+            }
+            pending.opened = true;
+            //only the owner hears about the session again
+            if (!pending.owner)
+            {
+                pending_.erase(iter);
+            }
+        }
+        else
+        {
+            //for a caller that saw the session running, a restore that fails to open is its end
+            if (code == -1 && pending.opened)
+            {
+                code = -2;
+            }
+            call_back = pending.call_back;
+            if (pending.owner)
+            {
+                auto session = sessions_.find(pending.input_url);
+                if (session != sessions_.end() && session->second.slot == slot && session->second.generation == pending.generation)
+                {
+                    sessions_.erase(session);
+                }
+            }
+            pending_.erase(iter);
+        }
+    }
+    if (call_back)
+    {
+        call_back(code, out_url, err);
+    }
+}
+
+bool WorkerPool::Call(int slot, json::value message, json::value &reply)
+{
+    std::map<int, json::value> replies = CallEach(std::vector<int>(1, slot), message);
+    auto iter = replies.find(slot);
+    if (iter == replies.end())
+    {
+        return false;
+    }
+    reply = iter->second;
+    return true;
+}
+
+std::map<int, json::value> WorkerPool::CallEach(const std::vector<int> &slots, const json::value &message)
+{
+    struct Outstanding
+    {
+        int slot;
+        int64_t id;
+        std::shared_ptr<IpcChannel> channel;
+    };
+    std::vector<Outstanding> calls;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (int slot : slots)
+        {
+            if (!workers_[slot]->alive)
+                continue;
+            calls.push_back(Outstanding{slot, next_id_++, workers_[slot]->channel});
+            calls_.insert(calls.back().id);
+        }
+    }
+    for (Outstanding &call : calls)
+    {
+        json::value request = message;
+        request["id"] = json::value::number(call.id);
+        if (!call.channel->Send(request))
+        {
+            call.channel.reset();
+        }
+    }
+
+    std::map<int, json::value> replies;
+    std::unique_lock<std::mutex> lock(mtx_);
+    //done when every call is answered or its worker went away
+    cv_.wait_for(lock, std::chrono::seconds(3), [&] {
+        return std::all_of(calls.begin(), calls.end(), [&](const Outstanding &call) {
+            return !call.channel || replies_.count(call.id) || !workers_[call.slot]->alive || workers_[call.slot]->channel != call.channel;
+        });
+    });
+    for (const Outstanding &call : calls)
+    {
+        auto iter = replies_.find(call.id);
+        if (iter != replies_.end())
+        {
+            replies[call.slot] = iter->second;
+            replies_.erase(iter);
+        }
+        else
+        {
+            spdlog::warn("WorkerPool worker {} did not answer {}", call.slot, message.at("op").as_string());
+        }
+        calls_.erase(call.id);
+    }
+    return replies;
+}
+
+void WorkerPool::CallAsync(int slot, json::value message, const ReplyFunc &done)
+{
+    std::shared_ptr<IpcChannel> channel;
+    int64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (workers_[slot]->alive)
+        {
+            channel = workers_[slot]->channel;
+            id = next_id_++;
+            async_calls_[id] = AsyncCall{channel, done};
+        }
+    }
+    if (!channel)
+    {
+        done(nullptr);
+        return;
+    }
+    //a failed send means the worker is going, its reader answers the call with nullptr when it ends
+    message["id"] = json::value::number(id);
+    channel->Send(message);
+}
+
+std::shared_ptr<IpcChannel> WorkerPool::Channel(int slot)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!workers_[slot]->alive)
+    {
+        return nullptr;
+    }
+    return workers_[slot]->channel;
+}
+
+//called with mtx_ held, the fewest sessions wins and exclude only if nothing else is up
+int WorkerPool::PickWorker(int exclude)
+{
+    std::vector<int> load(workers_.size(), 0);
+    for (auto &item : sessions_)
+    {
+        load[item.second.slot]++;
+    }
+    int best = -1;
+    for (auto &worker : workers_)
+    {
+        if (!worker->alive || worker->slot == exclude)
+            continue;
+        if (best < 0 || load[worker->slot] < load[best])
+            best = worker->slot;
+    }
+    if (best < 0)
+    {
+        best = exclude >= 0 ? exclude : 0;
+    }
+    return best;
+}
+
+json::value WorkerPool::StartMessage(int64_t id, const std::string &input_url, const ProxySession &session)
+{
+    auto message = json::value::object();
+    message["op"] = json::value::string("start");
+    message["id"] = json::value::number(id);
+    message["input_url"] = json::value::string(input_url);
+    message["output_url"] = json::value::string(session.output_url);
+    message["options"] = OptionsToJson(session.options);
+    return message;
+}
+
+void RunWorker(int fd, const std::shared_ptr<TransformStreamApi> &transform_api)
+{
+    //session callbacks may still fire while the TransformStream shuts down, they keep the channel alive
+    auto channel = std::make_shared<IpcChannel>(fd);
+    json::value message;
+    while (channel->Receive(message))
+    {
+        try
+        {
+            std::string op = message.at("op").as_string();
+            json::value id = message.at("id");
+            if (op == "start")
+            {
+                std::string output_url = message.at("output_url").as_string();
+                transform_api->start(message.at("input_url").as_string(), output_url, OptionsFromJson(message.at("options")), [channel, id](int code, const std::string out_url, const std::string &err) {
+                    auto event = json::value::object();
+                    event["op"] = json::value::string("event");
+                    event["id"] = id;
+                    event["code"] = json::value::number(code);
+                    event["out_url"] = json::value::string(out_url);
+                    event["err"] = json::value::string(err);
+                    channel->Send(event);
+                });
+                continue;
+            }
+
+            auto reply = json::value::object();
+            reply["op"] = json::value::string("reply");
+            reply["id"] = id;
+            std::string err;
+            if (op == "stop")
+            {
+                //answered once the session let go of its output, the reader goes on meanwhile
+                transform_api->stop(message.at("url").as_string(), [channel, reply](const std::string &err) mutable {
+                    reply["err"] = json::value::string(err);
+                    channel->Send(reply);
+                });
+                continue;
+            }
+            if (op == "sessions")
+            {
+                std::vector<TransformSessionInfo> infos;
+                transform_api->sessions(infos);
+                auto data = json::value::array(infos.size());
+                for (size_t i = 0; i < infos.size(); i++)
+                {
+                    auto item = json::value::object();
+                    item["url"] = json::value::string(infos[i].input_url);
+                    item["output_url"] = json::value::string(infos[i].output_url);
+                    item["shm"] = json::value::string(infos[i].shm_name);
+                    item["dvr"] = json::value::number(infos[i].dvr_minutes);
+                    item["thin"] = json::value::number(infos[i].thin);
+                    item["input_bitrate"] = json::value::number(infos[i].input_bitrate);
+                    item["active_url"] = json::value::string(infos[i].active_url);
+                    item["reconnects"] = json::value::number(infos[i].reconnects);
+                    item["last_reconnect_ms"] = json::value::number(infos[i].last_reconnect_ms);
+                    auto memory = json::value::object();
+                    memory["packet"] = json::value::number(infos[i].memory_packet);
+                    memory["avio"] = json::value::number(infos[i].memory_avio);
+                    memory["cache"] = json::value::number(infos[i].memory_cache);
+                    memory["ring"] = json::value::number(infos[i].memory_ring);
+                    item["memory"] = memory;
+                    data[i] = item;
+                }
+                reply["sessions"] = data;
+            }
+            else if (op == "replay")
+            {
+                std::string output_url = message.at("output_url").as_string();
+                transform_api->replay(message.at("url").as_string(), message.at("offset_ms").as_number().to_int64(), message.at("speed").as_double(), output_url, err);
+                reply["output_url"] = json::value::string(output_url);
+            }
+            reply["err"] = json::value::string(err);
+            channel->Send(reply);
+        }
+        catch (const std::exception &e)
+        {
+            spdlog::error("RunWorker bad message: {}", e.what());
+        }
+    }
+    spdlog::info("RunWorker supervisor closed the channel, worker exits");
+}
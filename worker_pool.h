@@ -0,0 +1,118 @@
+#pragma once
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string>
+#include <condition_variable>
+#include <sys/types.h>
+#include <cpprest/json.h>
+#include "transform_stream_api.h"
+
+//One JSON message per line over a Unix stream socket. Send may be called from any thread, Receive
+//from one reader only.
+class IpcChannel
+{
+public:
+    explicit IpcChannel(int fd);
+    ~IpcChannel();
+    bool Send(const web::json::value &message);
+    bool Receive(web::json::value &message);
+    //wakes a blocked Receive, the peer sees end of file
+    void Shutdown();
+
+private:
+    int fd_;
+    std::mutex write_mtx_;
+    std::string buffer_;
+};
+
+//Supervisor side of multi-process mode. Every worker is this executable started with --worker and
+//runs a TransformStream of its own, sessions are placed on the worker with the fewest and API calls go
+//over an IpcChannel. A worker that dies is started again and its sessions are started on the other
+//workers with the same output url, callers waiting for a first frame or a session end keep waiting.
+class WorkerPool : public TransformStreamApi
+{
+public:
+    WorkerPool(int workers, const std::string &config_file);
+    ~WorkerPool();
+    void set_media_host(const std::string &host_addr) override;
+    void start(const std::string &input_url, std::string &output_url, const TransformOptions &options, const std::function<void(int, const std::string out_url, const std::string &err)> call_back) override;
+    void stop(const std::string &input_url, const std::function<void(const std::string &err)> call_back) override;
+    bool sessions(std::vector<TransformSessionInfo> &infos) override;
+    void replay(const std::string &input_url, int64_t offset_ms, double speed, std::string &output_url, std::string &err) override;
+    void worker_pids(std::vector<int> &pids) override;
+
+private:
+    typedef std::function<void(int, const std::string out_url, const std::string &err)> CallBack;
+    //the reply, or nullptr if the worker went away first
+    typedef std::function<void(const web::json::value *reply)> ReplyFunc;
+    struct Worker
+    {
+        int slot = 0;
+        pid_t pid = -1;
+        bool alive = false;
+        int64_t spawned_ms = 0;
+        std::shared_ptr<IpcChannel> channel;
+        std::thread reader;
+    };
+    struct ProxySession
+    {
+        int slot = 0;
+        int64_t generation = 0; //tells a session started again during a stop from the stopped one
+        bool stopping = false;  //a start arriving now opens a new generation instead of joining
+        std::string output_url;
+        TransformOptions options;
+    };
+    //a start call waiting for events of its session
+    struct Pending
+    {
+        std::string input_url;
+        int64_t generation = 0; //of the ProxySession it belongs to
+        CallBack call_back;
+        bool owner = false;  //opened the session, told when it ends
+        bool opened = false; //first frame already reported
+    };
+    struct AsyncCall
+    {
+        std::shared_ptr<IpcChannel> channel; //answered on this one or not at all
+        ReplyFunc done;
+    };
+
+    bool Spawn(Worker &worker);
+    void ReadLoop(Worker *worker, std::shared_ptr<IpcChannel> channel);
+    void RestartLoop();
+    void OnEvent(int slot, const web::json::value &message);
+    //sends message with a fresh id and waits for the reply, false if the worker is gone or too slow
+    bool Call(int slot, web::json::value message, web::json::value &reply);
+    //the same to every slot at once, one wedged worker costs a single timeout; replies by slot
+    std::map<int, web::json::value> CallEach(const std::vector<int> &slots, const web::json::value &message);
+    //sends message with a fresh id, done runs on the reader thread once it is answered, nobody waits
+    void CallAsync(int slot, web::json::value message, const ReplyFunc &done);
+    std::shared_ptr<IpcChannel> Channel(int slot);
+    int PickWorker(int exclude);
+    web::json::value StartMessage(int64_t id, const std::string &input_url, const ProxySession &session);
+
+    std::string config_file_;
+    std::string host_addr_;
+    std::atomic_bool quit_{false};
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::map<std::string, ProxySession> sessions_;
+    std::map<int64_t, Pending> pending_;
+    std::map<int64_t, web::json::value> replies_;
+    std::set<int64_t> calls_; //ids still waited for, a late reply to anything else is dropped
+    std::map<int64_t, AsyncCall> async_calls_;
+    std::map<std::string, int> replays_; //replay output url -> slot
+    std::vector<int> crashed_;
+    int64_t next_id_ = 0;
+    int index_ = 0;
+    std::thread restarter_;
+};
+
+//worker process side, serves the supervisor on fd until it goes away
+void RunWorker(int fd, const std::shared_ptr<TransformStreamApi> &transform_api);